@@ -0,0 +1,155 @@
+#include <iostream>
+#include <thread>
+#include <algorithm>
+#include "batch.h"
+
+using namespace std;
+
+Batch::Batch(const Options &opts)
+   : opts(opts)
+   , jobs(opts.batch_jobs)
+   , next_job(0)
+   , opening(0)
+   , open_files(opts.batch_open_files)
+   , num_threads(opts.num_threads)
+{
+}
+
+/*! Score every job with one pool of threads.
+ *
+ * An error in any job stops the batch once the threads have stopped, and
+ * is thrown again here.
+ */
+void Batch::run(void)
+{
+   vector<thread> threads(num_threads);
+
+   for (int thread_count = 0; thread_count < num_threads; thread_count++)
+   {
+      threads[thread_count] = thread(&Batch::batch_worker, this, thread_count);
+   }
+
+   for (int thread_count = 0; thread_count < num_threads; thread_count++)
+   {
+       threads[thread_count].join();
+   }
+
+   if (batch_error)
+      rethrow_exception(batch_error);
+}
+
+void Batch::batch_worker(int thread_count)
+{
+   Profiler::set_thread(thread_count);
+
+   try
+   {
+      ScorerPtr scorer = next_scorer();
+
+      while (scorer)
+      {
+         if (scorer->score_next_spectrum(thread_count) and scorer->is_complete())
+         {
+            complete_scorer(scorer);
+         }
+         scorer = next_scorer();
+      }
+   }
+   catch (...)
+   {
+      // the other threads stop at their next job, run throws the first error
+      batch_lock.lock();
+      if (!batch_error)
+         batch_error = current_exception();
+      batch_lock.unlock();
+      batch_changed.notify_all();
+   }
+}
+
+/*! Find an open job with spectra no thread has started on, opening the next
+ * job if there is none and fewer than open_files jobs are open.
+ *
+ * @return The job to take a spectrum from, or null once no job has spectra
+ * left to start.
+ */
+ScorerPtr Batch::next_scorer(void)
+{
+   unique_lock<mutex> lock(batch_lock);
+
+   while (true)
+   {
+      if (batch_error)
+         return nullptr;
+
+      for (auto &scorer : open_scorers)
+      {
+         if (scorer->has_spectra_todo())
+            return scorer;
+      }
+
+      if (next_job < jobs.size() and open_scorers.size() + opening < open_files)
+      {
+         Options job_opts(opts);
+         job_opts.in_file = jobs[next_job].first;
+         job_opts.out_file = jobs[next_job].second;
+         next_job++;
+         // each job reports its own progress
+         if (opts.status_file != "")
+            job_opts.status_file = opts.status_file + "." + to_string(next_job);
+
+         // loading the index takes a while, so let the other threads carry on
+         opening++;
+         lock.unlock();
+         ScorerPtr scorer;
+         try
+         {
+            scorer = make_shared<Scorer>(job_opts);
+            if (scorer->is_complete())
+            {
+               // nothing selected to score
+               scorer->finish();
+            }
+         }
+         catch (...)
+         {
+            lock.lock();
+            opening--;
+            throw;
+         }
+         lock.lock();
+         opening--;
+         if (!scorer->is_complete())
+            open_scorers.push_back(scorer);
+         batch_changed.notify_all();
+      }
+      else if (next_job >= jobs.size() and opening == 0)
+      {
+         // the open jobs are finished by the threads scoring them
+         return nullptr;
+      }
+      else
+      {
+         // wait for a job to complete, or for another thread to open one
+         batch_changed.wait(lock);
+      }
+   }
+}
+
+/*! Finish a job once all its spectra are written, making room for the next.
+ *
+ * Several threads may see the job complete, only the first finishes it.
+ */
+void Batch::complete_scorer(ScorerPtr scorer)
+{
+   unique_lock<mutex> lock(batch_lock);
+   auto it = find(open_scorers.begin(), open_scorers.end(), scorer);
+   if (it == open_scorers.end())
+      return;
+   open_scorers.erase(it);
+   lock.unlock();
+
+   scorer->finish();
+
+   lock.lock();
+   batch_changed.notify_all();
+}
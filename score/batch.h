@@ -0,0 +1,47 @@
+#ifndef HITIME_BATCH_H
+#define HITIME_BATCH_H
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "options.h"
+#include "score.h"
+
+using namespace std;
+
+typedef shared_ptr<Scorer> ScorerPtr;
+
+/*! Score many input files in one run.
+ *
+ * One pool of worker threads takes spectra from every open file, so threads
+ * move on to the next file while the last spectra of a file finish. At most
+ * batch_open_files files are open at once, each with its own spectrum cache,
+ * which bounds memory. Each file is scored by its own Scorer, so its outputs
+ * are the same as a run over that file alone.
+ */
+class Batch
+{
+private:
+   Options opts; //!< Options shared by every job, without input and output files
+   vector<pair<string, string>> jobs; //!< Input and output file of each job
+   Size next_job; //!< Next job to open
+   Size opening; //!< Number of jobs being opened by a thread
+   Size open_files; //!< Largest number of jobs open at once
+   int num_threads;
+   vector<ScorerPtr> open_scorers; //!< Jobs open and not yet complete, in job order
+   mutex batch_lock;
+   condition_variable batch_changed; //!< Signalled when a job is opened or completed, or fails
+   exception_ptr batch_error; //!< First error of a job, thrown again by run
+
+   // methods
+   ScorerPtr next_scorer(void);
+   void complete_scorer(ScorerPtr scorer);
+
+public:
+   Batch(const Options &opts);
+   void run(void);
+   void batch_worker(int thread_count);
+};
+#endif
@@ -1,3 +1,3 @@
 #!/bin/bash
 
-rm -fr cmake_install.cmake CMakeCache.txt CMakeFiles hitime libmy_custom_lib.a Makefile
+rm -fr cmake_install.cmake CMakeCache.txt CMakeFiles hitime-bench hitime-compare hitime-generate hitime-merge hitime-score hitime-test libhitime.a libhitime_core.a Makefile CTestTestfile.cmake Testing
@@ -0,0 +1,458 @@
+#include <OpenMS/FORMAT/IndexedMzMLFileLoader.h>
+#include <OpenMS/KERNEL/OnDiscMSExperiment.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "compare.h"
+#include "constants.h"
+
+using namespace OpenMS;
+
+CompareTolerances::CompareTolerances()
+    : abs_tol(default_compare_abs_tol)
+    , rel_tol(default_compare_rel_tol)
+    , max_zero_mismatches(0)
+    , max_errors(0)
+    , score_column(3)
+    , show(10)
+{
+}
+
+//! A scored point of an output.
+struct ScorePoint
+{
+    double rt;
+    double mz;
+    double score;
+};
+
+/*! Reads the scored points of an output in order, by retention time then
+ * M/Z, without holding the whole output in memory.
+ */
+class PointStream
+{
+public:
+    virtual ~PointStream() {}
+    //! @brief Read the next point, false at the end of the output.
+    virtual bool next(ScorePoint &point) = 0;
+    //! @brief Size of the output read so far, for the report.
+    virtual string summary(void) const = 0;
+};
+
+/*! The points of an indexed mzML output.
+ *
+ * A thread of its own loads the index and decodes the spectra ahead into a
+ * short queue, so the two outputs of a comparison are decoded in parallel.
+ */
+class MzMLPointStream : public PointStream
+{
+private:
+    string in_file;
+    thread reader;
+    mutex queue_lock;
+    condition_variable queue_changed;
+    deque<PeakSpectrum> queue; //!< Spectra decoded and not yet compared
+    bool ended; //!< Set once the reader has queued every spectrum
+    bool stopping; //!< Set to stop the reader early
+    string error; //!< Set by the reader if the output cannot be read, thrown by next
+    PeakSpectrum spectrum; //!< Spectrum being compared
+    Size point_idx; //!< Next point of the spectrum
+    Size spectra; //!< Spectra taken from the queue
+    Size points;
+
+    void read(void);
+
+public:
+    MzMLPointStream(const string &in_file);
+    ~MzMLPointStream();
+    bool next(ScorePoint &point);
+    string summary(void) const { return to_string(spectra) + " spectra, " + to_string(points) + " points"; }
+};
+
+MzMLPointStream::MzMLPointStream(const string &in_file)
+    : in_file(in_file)
+    , ended(false)
+    , stopping(false)
+    , point_idx(0)
+    , spectra(0)
+    , points(0)
+{
+    reader = thread(&MzMLPointStream::read, this);
+}
+
+MzMLPointStream::~MzMLPointStream()
+{
+    queue_lock.lock();
+    stopping = true;
+    queue_lock.unlock();
+    queue_changed.notify_all();
+    reader.join();
+}
+
+void MzMLPointStream::read(void)
+{
+    OnDiscPeakMap map;
+    IndexedMzMLFileLoader mzml;
+    if (!mzml.load(in_file, map))
+    {
+        // the reader thread cannot throw, next throws once the queue is empty
+        queue_lock.lock();
+        error = "could not load indexed mzML file " + in_file;
+        ended = true;
+        queue_lock.unlock();
+        queue_changed.notify_all();
+        return;
+    }
+
+    for (Size spectrum_id = 0; spectrum_id < map.getNrSpectra(); ++spectrum_id)
+    {
+        PeakSpectrum decoded = map.getSpectrum(spectrum_id);
+        if (!decoded.isSorted())
+            decoded.sortByPosition();
+
+        unique_lock<mutex> lock(queue_lock);
+        queue_changed.wait(lock, [this] { return stopping or queue.size() < compare_queue_spectra; });
+        if (stopping)
+            return;
+        queue.push_back(move(decoded));
+        queue_changed.notify_all();
+    }
+
+    queue_lock.lock();
+    ended = true;
+    queue_lock.unlock();
+    queue_changed.notify_all();
+}
+
+bool MzMLPointStream::next(ScorePoint &point)
+{
+    while (point_idx >= spectrum.size())
+    {
+        unique_lock<mutex> lock(queue_lock);
+        queue_changed.wait(lock, [this] { return ended or !queue.empty(); });
+        if (queue.empty() and error != "")
+            throw runtime_error(error);
+        if (queue.empty())
+            return false;
+        spectrum = move(queue.front());
+        queue.pop_front();
+        queue_changed.notify_all();
+        point_idx = 0;
+        spectra++;
+    }
+
+    point.rt = spectrum.getRT();
+    point.mz = spectrum[point_idx].getMZ();
+    point.score = spectrum[point_idx].getIntensity();
+    point_idx++;
+    points++;
+    return true;
+}
+
+/*! The points of a CSV output, such as the local maxima of '--listmax'
+ * (RT, M/Z, score), or a full text dump with the score in another column.
+ * Lines starting with a letter, such as a header, are skipped.
+ */
+class CSVPointStream : public PointStream
+{
+private:
+    string in_file;
+    ifstream in_fs;
+    int score_column;
+    Size lines;
+
+public:
+    CSVPointStream(const string &in_file, int score_column);
+    bool next(ScorePoint &point);
+    string summary(void) const { return to_string(lines) + " lines"; }
+};
+
+CSVPointStream::CSVPointStream(const string &in_file, int score_column)
+    : in_file(in_file)
+    , in_fs(in_file)
+    , score_column(score_column)
+    , lines(0)
+{
+    if (!in_fs)
+    {
+        throw runtime_error(string("could not open ") + in_file);
+    }
+}
+
+bool CSVPointStream::next(ScorePoint &point)
+{
+    string line;
+    while (getline(in_fs, line))
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos or isalpha(line[first]))
+            continue;
+        lines++;
+
+        // the first two columns are RT and M/Z
+        const char *field = line.c_str();
+        int columns = 0;
+        while (true)
+        {
+            char *end;
+            double value = strtod(field, &end);
+            if (end == field)
+                break;
+            columns++;
+            if (columns == 1)
+                point.rt = value;
+            else if (columns == 2)
+                point.mz = value;
+            if (columns == score_column)
+                point.score = value;
+            field = strchr(end, ',');
+            if (field == NULL)
+                break;
+            field++;
+        }
+        if (columns < max(score_column, 2))
+        {
+            throw runtime_error("expected " + to_string(max(score_column, 2)) + " numeric columns on line "
+                                + to_string(lines) + " of " + in_file);
+        }
+        return true;
+    }
+    return false;
+}
+
+ErrorDistribution::ErrorDistribution()
+    : bins(decades * bins_per_decade + 3, 0)
+    , count(0)
+    , sum(0.0)
+    , sum_squares(0.0)
+    , max_error(0.0)
+{
+}
+
+void ErrorDistribution::add(double error)
+{
+    count++;
+    sum += error;
+    sum_squares += error * error;
+    max_error = max(max_error, error);
+
+    Size bin;
+    if (error == 0.0)
+    {
+        bin = 0;
+    }
+    else
+    {
+        double position = (log10(error) - lowest_decade) * bins_per_decade;
+        if (position < 0.0)
+            bin = 1;
+        else
+            bin = min(Size(position) + 2, bins.size() - 1);
+    }
+    bins[bin]++;
+}
+
+//! @brief Largest error in a bin, infinite for the last bin.
+double ErrorDistribution::bin_upper(Size bin)
+{
+    if (bin == 0)
+        return 0.0;
+    if (bin >= Size(decades * bins_per_decade + 2))
+        return numeric_limits<double>::infinity();
+    return pow(10.0, lowest_decade + double(bin - 1) / bins_per_decade);
+}
+
+//! @brief Upper bound of the error below which a fraction of the errors fall.
+double ErrorDistribution::quantile(double fraction) const
+{
+    Size rank = Size(ceil(fraction * count));
+    Size seen = 0;
+    for (Size bin = 0; bin < bins.size(); ++bin)
+    {
+        seen += bins[bin];
+        if (seen >= rank and seen > 0)
+            return min(bin_upper(bin), max_error);
+    }
+    return max_error;
+}
+
+/*! Print the summary statistics, quantiles and a histogram by decade.
+ */
+void ErrorDistribution::report(ostream &out, const string &name) const
+{
+    out << name << ": ";
+    if (count == 0)
+    {
+        out << "no points" << endl;
+        return;
+    }
+    out << setprecision(3) << "max " << max_error << ", mean " << sum / count
+        << ", rms " << sqrt(sum_squares / count) << endl;
+    out << "  quantiles: 50% <= " << quantile(0.5) << ", 90% <= " << quantile(0.9) << ", 99% <= "
+        << quantile(0.99) << ", 99.9% <= " << quantile(0.999) << endl;
+
+    if (bins[0] > 0)
+        out << "  " << setw(22) << "0" << setw(14) << bins[0] << endl;
+    if (bins[1] > 0)
+        out << "  " << setw(22) << "< 1e" + to_string(lowest_decade) << setw(14) << bins[1] << endl;
+    for (int decade = 0; decade < decades; ++decade)
+    {
+        Size decade_count = 0;
+        for (int bin = 0; bin < bins_per_decade; ++bin)
+            decade_count += bins[2 + decade * bins_per_decade + bin];
+        if (decade_count > 0)
+        {
+            int exponent = lowest_decade + decade;
+            out << "  " << setw(22) << "[1e" + to_string(exponent) + ", 1e" + to_string(exponent + 1) + ")"
+                << setw(14) << decade_count << endl;
+        }
+    }
+    if (bins.back() > 0)
+        out << "  " << setw(22) << ">= 1e" + to_string(lowest_decade + decades) << setw(14) << bins.back() << endl;
+}
+
+//! @brief Order of two points by retention time then M/Z, equal within compare_position_tol.
+static int compare_position(const ScorePoint &a, const ScorePoint &b)
+{
+    if (fabs(a.rt - b.rt) > compare_position_tol * max(fabs(a.rt), 1.0))
+        return a.rt < b.rt ? -1 : 1;
+    if (fabs(a.mz - b.mz) > compare_position_tol * max(fabs(a.mz), 1.0))
+        return a.mz < b.mz ? -1 : 1;
+    return 0;
+}
+
+static bool is_mzml_file(const string &file)
+{
+    size_t dot = file.find_last_of('.');
+    if (dot == string::npos)
+        return false;
+    string extension = file.substr(dot);
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".mzml";
+}
+
+static unique_ptr<PointStream> open_points(const string &file, int score_column)
+{
+    if (is_mzml_file(file))
+        return unique_ptr<PointStream>(new MzMLPointStream(file));
+    return unique_ptr<PointStream>(new CSVPointStream(file, score_column));
+}
+
+/*! Compare the scores of two HiTIME outputs point by point, such as the
+ * output of an optimised mode against the reference.
+ *
+ * Both outputs are streamed in retention time then M/Z order and joined on
+ * the position of each point. A point missing from one output, e.g. as
+ * its zero scores were removed, counts as a zero score there. A point with
+ * a zero score in one output and not the other is a zero mismatch. Any
+ * other point with a nonzero score is an error if it is outside both the
+ * absolute and the relative tolerance. Points zero in both are only
+ * counted.
+ *
+ * @param first_file Output of the reference, mzML or CSV by extension.
+ * @param second_file Output to check against it.
+ * @param tolerances Limits the comparison must stay within.
+ * @param out Stream to write the report to.
+ *
+ * @return True if the outputs are within the tolerances.
+ */
+bool compare_outputs(const string &first_file, const string &second_file,
+                     const CompareTolerances &tolerances, ostream &out)
+{
+    unique_ptr<PointStream> first = open_points(first_file, tolerances.score_column);
+    unique_ptr<PointStream> second = open_points(second_file, tolerances.score_column);
+
+    ErrorDistribution abs_errors;
+    ErrorDistribution rel_errors;
+    Size both = 0;
+    Size only_first = 0;
+    Size only_second = 0;
+    Size both_zero = 0;
+    Size first_zero = 0;
+    Size second_zero = 0;
+    Size errors = 0;
+    Size shown = 0;
+
+    ScorePoint first_point = {0.0, 0.0, 0.0};
+    ScorePoint second_point = {0.0, 0.0, 0.0};
+    bool has_first = first->next(first_point);
+    bool has_second = second->next(second_point);
+    out << setprecision(10);
+    while (has_first or has_second)
+    {
+        int order = !has_second ? -1 : !has_first ? 1 : compare_position(first_point, second_point);
+        const ScorePoint &position = order <= 0 ? first_point : second_point;
+        double first_score = order <= 0 ? first_point.score : 0.0;
+        double second_score = order >= 0 ? second_point.score : 0.0;
+        if (order < 0)
+            only_first++;
+        else if (order > 0)
+            only_second++;
+        else
+            both++;
+
+        if (first_score == 0.0 and second_score == 0.0)
+        {
+            both_zero++;
+        }
+        else
+        {
+            double abs_error = fabs(first_score - second_score);
+            double rel_error = abs_error / max(fabs(first_score), fabs(second_score));
+            abs_errors.add(abs_error);
+            rel_errors.add(rel_error);
+
+            const char *problem = NULL;
+            if (first_score == 0.0 or second_score == 0.0)
+            {
+                (first_score == 0.0 ? first_zero : second_zero)++;
+                problem = "zero mismatch";
+            }
+            else if (abs_error > tolerances.abs_tol and rel_error > tolerances.rel_tol)
+            {
+                errors++;
+                problem = "outside tolerance";
+            }
+            if (problem != NULL and shown < tolerances.show)
+            {
+                out << problem << " at RT " << position.rt << " M/Z " << position.mz << ": first "
+                    << first_score << ", second " << second_score << endl;
+                shown++;
+            }
+        }
+
+        if (order <= 0)
+            has_first = first->next(first_point);
+        if (order >= 0)
+            has_second = second->next(second_point);
+    }
+
+    Size zero_mismatches = first_zero + second_zero;
+    out << "first:  " << first_file << ", " << first->summary() << endl;
+    out << "second: " << second_file << ", " << second->summary() << endl;
+    out << "points in both: " << both << ", only in first: " << only_first
+        << ", only in second: " << only_second << ", zero in both: " << both_zero << endl;
+    out << "zero mismatches: " << zero_mismatches << " (zero in first only: " << first_zero
+        << ", zero in second only: " << second_zero << ")" << endl;
+    abs_errors.report(out, "absolute error of nonzero points");
+    rel_errors.report(out, "relative error of nonzero points");
+    out << setprecision(3) << "outside tolerance (absolute " << tolerances.abs_tol << " and relative "
+        << tolerances.rel_tol << "): " << errors << endl;
+
+    bool pass = zero_mismatches <= tolerances.max_zero_mismatches and errors <= tolerances.max_errors;
+    out << (pass ? "PASS" : "FAIL") << endl;
+    return pass;
+}
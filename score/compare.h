@@ -0,0 +1,57 @@
+#ifndef HITIME_COMPARE_H
+#define HITIME_COMPARE_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*! Distribution of the errors of compared scores, as counts in bins of a
+ * tenth of a decade, so it takes constant memory however many scores are
+ * compared. Quantiles are given as the upper edge of their bin. Used by
+ * hitime-compare and '--verify'.
+ */
+class ErrorDistribution
+{
+private:
+    static const int lowest_decade = -20;
+    static const int decades = 30;
+    static const int bins_per_decade = 10;
+    vector<size_t> bins; //!< Zero errors, errors below the lowest decade, each bin, then larger errors
+    size_t count;
+    double sum;
+    double sum_squares;
+    double max_error;
+
+    static double bin_upper(size_t bin);
+
+public:
+    ErrorDistribution();
+    void add(double error);
+    size_t size(void) const { return count; }
+    double quantile(double fraction) const;
+    void report(ostream &out, const string &name) const;
+};
+
+//! Limits a comparison of two outputs must stay within to pass.
+struct CompareTolerances
+{
+    double abs_tol; //!< Largest absolute score error of a point
+    double rel_tol; //!< Largest score error of a point relative to the larger score
+    size_t max_zero_mismatches; //!< Points allowed a zero score in one output and not the other
+    size_t max_errors; //!< Points allowed outside both abs_tol and rel_tol
+    int score_column; //!< Column of the score in CSV outputs, from 1
+    size_t show; //!< Number of failing points to print
+
+    CompareTolerances();
+};
+
+/*! @brief Compare the scores of two HiTIME outputs, mzML or CSV, and report
+ * the differences.
+ */
+bool compare_outputs(const string &first_file, const string &second_file,
+                     const CompareTolerances &tolerances, ostream &out);
+
+#endif
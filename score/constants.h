@@ -2,6 +2,7 @@
 #define HITIME_CONSTANTS_H
 
 #include <math.h>
+#include <string>
 
 //! Convert standard deviation to FWHM
 const float std_dev_in_fwhm = 2.355;
@@ -24,6 +25,8 @@ const float default_rt_sigma = 2;
  */
 const float default_min_sample = default_rt_width * default_rt_sigma / std_dev_in_fwhm;
 const double root2pi = sqrt(2.0 * M_PI);
+//! Scale median absolute deviation to standard deviation for normal data.
+const double mad_to_std_dev = 1.4826;
 // The name of the program
 const std::string program_name = "HiTIME";
 // Number of spectra to keep in cache when reading from file.
@@ -32,5 +35,48 @@ const std::string program_name = "HiTIME";
 // If we make it too big we might keep spectra in memory longer than needed and thus may
 // waste some space.
 const int default_input_spectrum_cache_size = 50;
+// Number of input files a batch keeps open at once. Each open file holds its
+// own spectrum cache, so this bounds the memory of a batch. More than one lets
+// threads start on the next file while the last spectra of a file finish.
+const int default_batch_open_files = 2;
+// Number of decoded spectra a server keeps for each input file, and the number
+// of input files it keeps loaded, for later jobs on the same files.
+const int default_serve_cache_size = 2000;
+const int default_serve_files = 2;
+// Number of spans '--trace' keeps for each thread, the latest overwriting the
+// oldest. Scoring a spectrum takes a few spans for each row of its window.
+// At 24 bytes a span this is at most 1.5 MB for each thread.
+const int default_trace_spans = 65536;
+// Seconds between '--progress' reports and status file updates.
+const double default_progress_interval = 10.0;
+// hitime-compare: default score tolerances, a point fails only outside both,
+// the relative tolerance of matching point positions, and the number of
+// spectra each mzML output decodes ahead of the comparison.
+const double default_compare_abs_tol = 1e-9;
+const double default_compare_rel_tol = 1e-6;
+const double compare_position_tol = 1e-7;
+const size_t compare_queue_spectra = 16;
+// Number of zero/nonzero disagreements '--verify' prints.
+const size_t verify_show = 5;
+
+/*! @brief Largest gap within a profile peak, in median point spacings.
+ *
+ * Larger gaps between neighbouring points split peaks when centroiding.
+ */
+const double centroid_max_gap = 4.0;
+
+//! Default M/Z tolerance in PPM of a scoring target.
+const double default_target_ppm = 10.0;
+
+// Delta discovery: range of M/Z deltas to consider and histogram bin width.
+const double default_discover_min_delta = 1.0;
+const double default_discover_max_delta = 20.0;
+const double default_discover_bin_width = 0.001;
+// Delta discovery: number of most intense peaks in each spectrum to pair up.
+// The work per spectrum grows with the square of this number, times the
+// rows of the RT window.
+const int default_discover_peaks = 100;
+// Delta discovery: number of candidate deltas to report.
+const int default_discover_top = 20;
 
 #endif
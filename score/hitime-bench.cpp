@@ -0,0 +1,695 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "constants.h"
+#include "cxxopts.h"
+#include "json.h"
+#include "kernel.h"
+#include "lru_cache.h"
+#include "vector.h"
+#include "version.h"
+
+/*
+ * Microbenchmarks of the scoring kernels (kernel.h), the spectrum cache
+ * (lru_cache.h) and the vector library (vector.h).
+ *
+ * Only the OpenMS-free core is used, so the benchmarks build wherever
+ * hitime_core does. The windows are taken from the spectra of an mzML
+ * file, and from synthetic spectra of the same shape, and every case is
+ * run at each combination of the requested RT and M/Z widths. Results are
+ * written as JSON, in nanoseconds per call, per window and per data point.
+ */
+
+using namespace std;
+
+//! M/Z and intensity of the points of each spectrum, in spectrum order.
+struct BenchData
+{
+    string name;
+    double_2d mz_vals;
+    double_2d amp_vals;
+};
+
+//! A scoring window: centre point, its rows and the data in each ion region.
+struct BenchWindow
+{
+    size_t centre_row;
+    size_t first_row; //!< First row of the window in the data set
+    double centre;
+    double centre_amp;
+    double_2d mz_rows; //!< Copies of the window rows, as local_max_data takes them
+    double_2d amp_rows;
+    double_2d data_regions; //!< Natural and heavy ion regions
+    double_2d shape_regions;
+};
+
+//! Timing of one benchmark case.
+struct BenchResult
+{
+    string name;
+    string source;
+    string params; //!< JSON members describing the case parameters
+    size_t iterations; //!< Calls of the kernel timed
+    double seconds;
+    double windows; //!< Windows processed per call, zero if not window based
+    double peaks; //!< Data points processed per call, zero if not point based
+};
+
+/*! Decode base64 text into bytes.
+ */
+static string decode_base64(const string &text)
+{
+    string bytes;
+    unsigned int bits = 0;
+    int num_bits = 0;
+
+    for (char c : text)
+    {
+        int value;
+        if (c >= 'A' and c <= 'Z') value = c - 'A';
+        else if (c >= 'a' and c <= 'z') value = c - 'a' + 26;
+        else if (c >= '0' and c <= '9') value = c - '0' + 52;
+        else if (c == '+') value = 62;
+        else if (c == '/') value = 63;
+        else continue;
+
+        bits = (bits << 6) | value;
+        num_bits += 6;
+        if (num_bits >= 8)
+        {
+            num_bits -= 8;
+            bytes.push_back(char((bits >> num_bits) & 0xFF));
+        }
+    }
+    return bytes;
+}
+
+/*! Decode one binaryDataArray element of an mzML spectrum.
+ *
+ * Only uncompressed arrays are read, as the benchmark does not depend on
+ * zlib. Little endian byte order is assumed, as mzML requires.
+ */
+static double_vect decode_array(const string &array, const string &file)
+{
+    if (array.find("MS:1000576") == string::npos)
+    {
+        cerr << program_name << " ERROR: compressed data in " << file
+             << " is not supported by the benchmark, convert with no compression" << endl;
+        exit(-1);
+    }
+    bool is_float = array.find("MS:1000521") != string::npos;
+
+    size_t start = array.find("<binary>");
+    size_t end = array.find("</binary>");
+    string bytes;
+    if (start != string::npos and end != string::npos)
+        bytes = decode_base64(array.substr(start + 8, end - start - 8));
+
+    double_vect values;
+    if (is_float)
+    {
+        vector<float> floats(bytes.size() / sizeof(float));
+        copy(bytes.begin(), bytes.begin() + floats.size() * sizeof(float), (char *) floats.data());
+        values.assign(floats.begin(), floats.end());
+    }
+    else
+    {
+        values.resize(bytes.size() / sizeof(double));
+        copy(bytes.begin(), bytes.begin() + values.size() * sizeof(double), (char *) values.data());
+    }
+    return values;
+}
+
+/*! Read the M/Z and intensity arrays of each spectrum in an mzML file.
+ */
+static BenchData read_mzml(const string &file)
+{
+    ifstream in(file);
+    if (!in)
+    {
+        cerr << program_name << " ERROR: cannot read " << file << endl;
+        exit(-1);
+    }
+    stringstream buffer;
+    buffer << in.rdbuf();
+    string text = buffer.str();
+
+    BenchData data;
+    data.name = file.substr(file.find_last_of('/') + 1);
+
+    size_t pos = 0;
+    while ((pos = text.find("<spectrum ", pos)) != string::npos)
+    {
+        size_t end = text.find("</spectrum>", pos);
+        if (end == string::npos) break;
+        string spectrum = text.substr(pos, end - pos);
+        pos = end;
+
+        double_vect mz;
+        double_vect amp;
+        size_t array_pos = 0;
+        while ((array_pos = spectrum.find("<binaryDataArray ", array_pos)) != string::npos)
+        {
+            size_t array_end = spectrum.find("</binaryDataArray>", array_pos);
+            string array = spectrum.substr(array_pos, array_end - array_pos);
+            array_pos = array_end;
+
+            if (array.find("MS:1000514") != string::npos)
+                mz = decode_array(array, file);
+            else if (array.find("MS:1000515") != string::npos)
+                amp = decode_array(array, file);
+        }
+        if (mz.size() != amp.size())
+        {
+            cerr << program_name << " ERROR: M/Z and intensity arrays differ in length in " << file << endl;
+            exit(-1);
+        }
+        data.mz_vals.push_back(mz);
+        data.amp_vals.push_back(amp);
+    }
+
+    if (data.mz_vals.empty())
+    {
+        cerr << program_name << " ERROR: no spectra found in " << file << endl;
+        exit(-1);
+    }
+    return data;
+}
+
+/*! Generate spectra of random noise with pairs of ion peaks, the heavier
+ * ion mz_delta above the natural ion, spread over several spectra.
+ *
+ * @param rows Number of spectra.
+ * @param points Number of noise points in each spectrum.
+ * @param seed Random seed, so runs are comparable.
+ */
+static BenchData synthetic_data(size_t rows, size_t points, double mz_delta, unsigned seed)
+{
+    mt19937 rng(seed);
+    uniform_real_distribution<double> mz_dist(100.0, 1000.0);
+    lognormal_distribution<double> noise_dist(6.0, 1.0);
+
+    BenchData data;
+    data.name = "synthetic";
+    data.mz_vals.resize(rows);
+    data.amp_vals.resize(rows);
+
+    vector<vector<pair<double, double>>> all_points(rows);
+    for (size_t row = 0; row < rows; ++row)
+    {
+        for (size_t point = 0; point < points; ++point)
+            all_points[row].push_back(make_pair(mz_dist(rng), noise_dist(rng)));
+    }
+
+    // ten ion pairs for every 20 spectra, each pair eluting over 20 spectra
+    uniform_int_distribution<size_t> row_dist(0, rows - 1);
+    for (size_t pair_idx = 0; pair_idx < rows / 20 * 10; ++pair_idx)
+    {
+        double mz = mz_dist(rng);
+        size_t apex = row_dist(rng);
+        for (int offset = -10; offset <= 10; ++offset)
+        {
+            if (int(apex) + offset < 0 or apex + offset >= rows) continue;
+            double height = 1e5 * exp(-0.5 * (offset / 4.0) * (offset / 4.0));
+            all_points[apex + offset].push_back(make_pair(mz, height));
+            all_points[apex + offset].push_back(make_pair(mz + mz_delta, height));
+        }
+    }
+
+    for (size_t row = 0; row < rows; ++row)
+    {
+        sort(all_points[row].begin(), all_points[row].end());
+        for (auto &point : all_points[row])
+        {
+            data.mz_vals[row].push_back(point.first);
+            data.amp_vals[row].push_back(point.second);
+        }
+    }
+    return data;
+}
+
+/*! Choose scoring windows at random centre points of a data set and collect
+ * their ion regions, the way Scorer does for one parameter set.
+ */
+static vector<BenchWindow> make_windows(const BenchData &data, const double_vect &rt_shape,
+                                        double mz_width, double mz_delta,
+                                        size_t num_windows, unsigned seed)
+{
+    vector<BenchWindow> windows;
+    size_t half_window = rt_shape.size() / 2;
+    if (data.mz_vals.size() < rt_shape.size())
+        return windows;
+
+    double mz_ppm_sigma = mz_width / (std_dev_in_fwhm * 1e6);
+    double lower_tol = 1.0 - default_mz_sigma * mz_ppm_sigma;
+    double upper_tol = 1.0 + default_mz_sigma * mz_ppm_sigma;
+
+    mt19937 rng(seed);
+    uniform_int_distribution<size_t> row_dist(half_window, data.mz_vals.size() - half_window - 1);
+
+    while (windows.size() < num_windows)
+    {
+        BenchWindow window;
+        window.centre_row = row_dist(rng);
+        window.first_row = window.centre_row - half_window;
+        const double_vect &centre_mz = data.mz_vals[window.centre_row];
+        if (centre_mz.empty()) continue;
+        size_t point = uniform_int_distribution<size_t>(0, centre_mz.size() - 1)(rng);
+        window.centre = centre_mz[point];
+        window.centre_amp = data.amp_vals[window.centre_row][point];
+
+        window.mz_rows.assign(data.mz_vals.begin() + window.first_row,
+                              data.mz_vals.begin() + window.first_row + rt_shape.size());
+        window.amp_rows.assign(data.amp_vals.begin() + window.first_row,
+                               data.amp_vals.begin() + window.first_row + rt_shape.size());
+
+        window.data_regions.resize(2);
+        window.shape_regions.resize(2);
+        for (size_t member = 0; member < 2; ++member)
+        {
+            double centre = window.centre + member * mz_delta;
+            collect_window_data(1.0, rt_shape, window.first_row,
+                                centre, centre * mz_ppm_sigma,
+                                data.mz_vals, data.amp_vals,
+                                centre * lower_tol, centre * upper_tol, false,
+                                window.data_regions[member], window.shape_regions[member]);
+        }
+        windows.push_back(window);
+    }
+    return windows;
+}
+
+//! RT model of a window, as in Scorer for one parameter set.
+static double_vect make_rt_shape(double rt_width)
+{
+    int half_window = ceil(default_rt_sigma * rt_width / std_dev_in_fwhm);
+    double local_rt_sigma = rt_width / std_dev_in_fwhm;
+    double_vect rt_shape(2 * half_window + 1);
+    for (int i = 0; i < int(rt_shape.size()); ++i)
+    {
+        double pt = (i - half_window) / local_rt_sigma;
+        rt_shape[i] = exp(-0.5 * pt * pt) / (local_rt_sigma * root2pi);
+    }
+    return rt_shape;
+}
+
+// Results of the kernels are added here, so they are not optimised away
+static volatile double bench_sink = 0.0;
+
+/*! Time a kernel, calling it until min_seconds have passed.
+ *
+ * @param kernel Called with the iteration number, runs the kernel once.
+ */
+static BenchResult time_case(const string &name, const string &source, const string &params,
+                             double windows, double peaks, double min_seconds,
+                             function<double(size_t)> kernel)
+{
+    typedef chrono::steady_clock clock;
+    BenchResult result = {name, source, params, 0, 0.0, windows, peaks};
+
+    // warm the caches before timing
+    for (size_t i = 0; i < 10; ++i)
+        bench_sink = bench_sink + kernel(i);
+
+    size_t batch = 1;
+    clock::time_point start = clock::now();
+    while (true)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < batch; ++i)
+            sum += kernel(result.iterations + i);
+        bench_sink = bench_sink + sum;
+        result.iterations += batch;
+        result.seconds = chrono::duration<double>(clock::now() - start).count();
+        if (result.seconds >= min_seconds)
+            break;
+        batch *= 2;
+    }
+    return result;
+}
+
+/*! Benchmark the kernels over the windows of one data set and one pair of
+ * RT and M/Z widths. Each call of a window kernel covers every window.
+ */
+static void bench_kernels(const BenchData &data, double rt_width, double mz_width,
+                          double mz_delta, size_t num_windows, double min_seconds,
+                          vector<BenchResult> &results)
+{
+    double_vect rt_shape = make_rt_shape(rt_width);
+    vector<BenchWindow> windows = make_windows(data, rt_shape, mz_width, mz_delta, num_windows, 1);
+    if (windows.empty())
+    {
+        cerr << program_name << " WARNING: " << data.name << " has fewer spectra than an RT width of "
+             << rt_width << " needs, skipped" << endl;
+        return;
+    }
+
+    ostringstream params;
+    params << "\"rt_width\": " << rt_width << ", \"mz_width\": " << mz_width
+           << ", \"window_rows\": " << rt_shape.size();
+
+    double mz_ppm_sigma = mz_width / (std_dev_in_fwhm * 1e6);
+    double lower_tol = 1.0 - default_mz_sigma * mz_ppm_sigma;
+    double upper_tol = 1.0 + default_mz_sigma * mz_ppm_sigma;
+    double_vect offsets = {mz_delta};
+    double_vect ratios = {1.0};
+
+    // points gathered into the ion regions of all windows
+    double region_peaks = 0.0;
+    for (auto &window : windows)
+        region_peaks += window.data_regions[0].size() + window.data_regions[1].size();
+
+    results.push_back(time_case("collect_window_data", data.name, params.str(),
+        windows.size(), region_peaks, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            double_vect data_out;
+            double_vect shape_out;
+            for (auto &window : windows)
+            {
+                for (size_t member = 0; member < 2; ++member)
+                {
+                    double centre = window.centre + member * mz_delta;
+                    data_out.clear();
+                    shape_out.clear();
+                    collect_window_data(1.0, rt_shape, window.first_row,
+                                        centre, centre * mz_ppm_sigma,
+                                        data.mz_vals, data.amp_vals,
+                                        centre * lower_tol, centre * upper_tol, false,
+                                        data_out, shape_out);
+                    sum += data_out.size();
+                }
+            }
+            return sum;
+        }));
+
+    results.push_back(time_case("count_window_data", data.name, params.str(),
+        windows.size(), region_peaks, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            for (auto &window : windows)
+            {
+                for (size_t member = 0; member < 2; ++member)
+                {
+                    double centre = window.centre + member * mz_delta;
+                    sum += count_window_data(window.first_row, rt_shape.size(), data.mz_vals,
+                                             centre * lower_tol, centre * upper_tol);
+                }
+            }
+            return sum;
+        }));
+
+    results.push_back(time_case("screen_centre_row", data.name, params.str(),
+        windows.size(), 0.0, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            for (auto &window : windows)
+            {
+                sum += screen_centre_row(data.mz_vals[window.centre_row], data.amp_vals[window.centre_row],
+                                         window.centre, offsets, ratios, 1.0, lower_tol, upper_tol);
+            }
+            return sum;
+        }));
+
+    results.push_back(time_case("local_max_data", data.name, params.str(),
+        windows.size(), 0.0, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            for (auto &window : windows)
+            {
+                sum += local_max_data(window.centre_amp, window.mz_rows, window.amp_rows,
+                                      window.centre * lower_tol, window.centre * upper_tol);
+            }
+            return sum;
+        }));
+
+    results.push_back(time_case("correlation", data.name, params.str(),
+        windows.size(), region_peaks, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            for (auto &window : windows)
+            {
+                sum += correlation(window.data_regions[0], window.shape_regions[0]);
+                sum += correlation(window.data_regions[1], window.shape_regions[1]);
+            }
+            return sum;
+        }));
+
+    results.push_back(time_case("combined_correlation", data.name, params.str(),
+        windows.size(), region_peaks, min_seconds, [&](size_t) {
+            double sum = 0.0;
+            for (auto &window : windows)
+            {
+                if (window.data_regions[0].empty() or window.data_regions[1].empty()) continue;
+                sum += combined_correlation(window.data_regions, window.shape_regions, 2);
+                sum += combined_correlation(window.data_regions, window.shape_regions, 2, 1);
+                sum += combined_correlation(window.shape_regions, window.shape_regions, 2, 1);
+            }
+            return sum;
+        }));
+
+    // one Z-score per call, from the sample size of a window
+    results.push_back(time_case("mengZ", data.name, params.str(),
+        0.0, 0.0, min_seconds, [&](size_t i) {
+            const BenchWindow &window = windows[i % windows.size()];
+            double samples = window.data_regions[0].size() + window.data_regions[1].size();
+            return mengZ(0.9, 0.3 + 1e-9 * (i % 1000), 0.4, size_t(samples), 1.96);
+        }));
+}
+
+/*! Benchmark the spectrum cache with the access pattern of scoring, where
+ * each centre row reads the rows of its window in turn.
+ */
+static void bench_cache(const BenchData &data, double rt_width, size_t cache_size,
+                        double min_seconds, vector<BenchResult> &results)
+{
+    typedef shared_ptr<double_vect> RowPtr;
+    size_t rows = data.mz_vals.size();
+    size_t window_rows = make_rt_shape(rt_width).size();
+
+    ostringstream params;
+    params << "\"rt_width\": " << rt_width << ", \"cache_size\": " << cache_size
+           << ", \"window_rows\": " << window_rows;
+
+    cache::lru_cache<int, RowPtr> row_cache(cache_size);
+    results.push_back(time_case("lru_cache", data.name, params.str(),
+        0.0, 0.0, min_seconds, [&](size_t i) {
+            size_t centre_row = i % rows;
+            size_t first_row = centre_row < window_rows / 2 ? 0 : centre_row - window_rows / 2;
+            double sum = 0.0;
+            for (size_t row = first_row; row < first_row + window_rows and row < rows; ++row)
+            {
+                if (!row_cache.exists(int(row)))
+                    row_cache.put(int(row), make_shared<double_vect>(data.amp_vals[row]));
+                sum += row_cache.get(int(row))->size();
+            }
+            return sum;
+        }));
+}
+
+/*! Benchmark each function of the vector library at one vector length.
+ */
+static void bench_vectors(size_t length, double min_seconds, vector<BenchResult> &results)
+{
+    mt19937 rng(1);
+    uniform_real_distribution<double> dist(0.1, 0.9);
+    double_vect a(length);
+    double_vect b(length);
+    double_vect c(length);
+    for (size_t i = 0; i < length; ++i)
+    {
+        a[i] = dist(rng);
+        b[i] = dist(rng);
+        c[i] = dist(rng);
+    }
+
+    ostringstream params;
+    params << "\"length\": " << length;
+    double peaks = length;
+
+    vector<pair<string, function<double(size_t)>>> cases = {
+        {"centre_vector", [&](size_t) { return centre_vector(a)[0]; }},
+        {"square_vector", [&](size_t) { return square_vector(a)[0]; }},
+        {"sum_vector", [&](size_t) { return sum_vector(a); }},
+        {"mean_vector", [&](size_t) { return mean_vector(a); }},
+        {"shift_vector", [&](size_t) { return shift_vector(a, 0.5)[0]; }},
+        {"mult_vectors", [&](size_t) { return mult_vectors(a, b)[0]; }},
+        {"div_vectors", [&](size_t) { return div_vectors(a, b)[0]; }},
+        {"correl_vectors", [&](size_t) { return correl_vectors(a, b, c)[0]; }},
+        {"rm_vectors", [&](size_t) { return rm_vectors(a, b)[0]; }},
+        {"f_vectors", [&](size_t) { return f_vectors(a, b)[0]; }},
+        {"h_vectors", [&](size_t) { return h_vectors(a, b)[0]; }},
+        {"z_vectors", [&](size_t) { return z_vectors(a, b, c, a, b)[0]; }},
+    };
+    for (auto &bench : cases)
+        results.push_back(time_case(bench.first, "random", params.str(), 0.0, peaks, min_seconds, bench.second));
+
+    results.push_back(time_case("mean_scalars", "random", "", 0.0, 0.0, min_seconds,
+        [&](size_t i) { return mean_scalars(a[i % length], b[i % length]); }));
+    results.push_back(time_case("mult_scalars", "random", "", 0.0, 0.0, min_seconds,
+        [&](size_t i) { return mult_scalars(a[i % length], b[i % length]); }));
+}
+
+//! Write the results as a JSON document.
+static void write_json(ostream &out, const vector<BenchResult> &results)
+{
+    out << "{" << endl;
+    out << "  \"program\": \"hitime-bench\"," << endl;
+    out << "  \"version\": \"" << HITIME_VERSION << "\"," << endl;
+    out << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &result = results[i];
+        double ns_per_call = 1e9 * result.seconds / result.iterations;
+        out << "    {\"name\": " << json_string(result.name) << ", \"source\": " << json_string(result.source) << ", "
+            << "\"params\": {" << result.params << "}, "
+            << "\"iterations\": " << result.iterations << ", "
+            << "\"ns_per_call\": " << ns_per_call;
+        if (result.windows > 0.0)
+            out << ", \"windows\": " << result.windows
+                << ", \"ns_per_window\": " << ns_per_call / result.windows;
+        if (result.peaks > 0.0)
+            out << ", \"peaks\": " << result.peaks
+                << ", \"ns_per_peak\": " << ns_per_call / result.peaks;
+        out << "}" << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+//! Parse a comma separated list of numbers.
+static double_vect parse_list(const string &text, const string &option)
+{
+    double_vect values;
+    stringstream in(text);
+    string item;
+    while (getline(in, item, ','))
+    {
+        try {
+            values.push_back(stod(item));
+        }
+        catch (const exception &)
+        {
+            cerr << program_name << " ERROR: '" << item << "' is not a number in --" << option << endl;
+            exit(-1);
+        }
+    }
+    return values;
+}
+
+int main(int argc, char** argv)
+{
+    string desc = "Benchmark the HiTIME scoring kernels, spectrum cache and vector library, reporting JSON";
+    vector<string> in_files;
+    string out_file;
+    double_vect rt_widths = {default_rt_width};
+    double_vect mz_widths = {default_fwhm};
+    double_vect lengths = {16, 256, 4096};
+    double mz_delta = default_mz_delta;
+    size_t num_windows = 1000;
+    size_t synthetic_rows = 200;
+    size_t synthetic_points = 1400;
+    double min_seconds = 0.2;
+
+    try {
+        cxxopts::Options options("hitime-bench", desc);
+        options.add_options()
+            ("h,help", "Show this help information.")
+            ("version", "Print version number and exit")
+            ("i,infile", "mzML file to take windows from, with uncompressed arrays. May be repeated", cxxopts::value<vector<string>>())
+            ("o,outfile", "JSON results file. Defaults to standard output", cxxopts::value<string>())
+            ("r,rtwidth", "Comma separated RT widths (FWHM, in scans) to run the kernels at. Defaults to 17", cxxopts::value<string>())
+            ("m,mzwidth", "Comma separated M/Z widths (FWHM, in PPM) to run the kernels at. Defaults to 150", cxxopts::value<string>())
+            ("d,mzdelta", "M/Z delta of the ion pairs. Defaults to 6.0201", cxxopts::value<double>())
+            ("windows", "Number of windows per data set. Defaults to 1000", cxxopts::value<size_t>())
+            ("lengths", "Comma separated vector lengths for the vector library. Defaults to 16,256,4096", cxxopts::value<string>())
+            ("synthetic", "Spectra and points per spectrum of the synthetic data, as spectra:points. Defaults to 200:1400", cxxopts::value<string>())
+            ("time", "Least time to run each case, in seconds. Defaults to 0.2", cxxopts::value<double>());
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help")) {
+            cout << options.help() << endl;
+            exit(0);
+        }
+        if (result.count("version")) {
+            cout << program_name << " version " << HITIME_VERSION << endl;
+            exit(0);
+        }
+        if (result.count("infile"))
+            in_files = result["infile"].as<vector<string>>();
+        if (result.count("outfile"))
+            out_file = result["outfile"].as<string>();
+        if (result.count("rtwidth"))
+            rt_widths = parse_list(result["rtwidth"].as<string>(), "rtwidth");
+        if (result.count("mzwidth"))
+            mz_widths = parse_list(result["mzwidth"].as<string>(), "mzwidth");
+        if (result.count("lengths"))
+            lengths = parse_list(result["lengths"].as<string>(), "lengths");
+        if (result.count("mzdelta"))
+            mz_delta = result["mzdelta"].as<double>();
+        if (result.count("windows"))
+            num_windows = result["windows"].as<size_t>();
+        if (result.count("time"))
+            min_seconds = result["time"].as<double>();
+        if (result.count("synthetic"))
+        {
+            string shape = result["synthetic"].as<string>();
+            if (sscanf(shape.c_str(), "%zu:%zu", &synthetic_rows, &synthetic_points) != 2)
+            {
+                cerr << program_name << " ERROR: --synthetic must be spectra:points" << endl;
+                exit(-1);
+            }
+        }
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+        std::cout << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
+
+    if (num_windows == 0 or min_seconds <= 0.0 or rt_widths.empty() or mz_widths.empty())
+    {
+        cerr << program_name << " ERROR: windows, time and the widths must be positive" << endl;
+        exit(-1);
+    }
+
+    vector<BenchData> data_sets;
+    for (auto &file : in_files)
+        data_sets.push_back(read_mzml(file));
+    if (synthetic_rows > 0)
+        data_sets.push_back(synthetic_data(synthetic_rows, synthetic_points, mz_delta, 1));
+
+    vector<BenchResult> results;
+    for (auto &data : data_sets)
+    {
+        for (double rt_width : rt_widths)
+        {
+            for (double mz_width : mz_widths)
+                bench_kernels(data, rt_width, mz_width, mz_delta, num_windows, min_seconds, results);
+            bench_cache(data, rt_width, default_input_spectrum_cache_size, min_seconds, results);
+        }
+    }
+    for (double length : lengths)
+        bench_vectors(size_t(length), min_seconds, results);
+
+    if (out_file.empty())
+    {
+        write_json(cout, results);
+    }
+    else
+    {
+        ofstream out(out_file);
+        if (!out)
+        {
+            cerr << program_name << " ERROR: cannot write " << out_file << endl;
+            exit(-1);
+        }
+        write_json(out, results);
+    }
+    return 0;
+}
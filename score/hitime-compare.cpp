@@ -0,0 +1,89 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "compare.h"
+#include "constants.h"
+#include "cxxopts.h"
+#include "version.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    string desc = "Compare the scores of two HiTIME outputs, e.g. an optimised mode against the reference, and fail if they differ by more than the tolerances";
+    vector<string> in_files;
+    CompareTolerances tolerances;
+
+    try {
+        cxxopts::Options options("hitime-compare", desc);
+        options.positional_help("first second");
+        options.add_options()
+            ("h,help", "Show this help information.")
+            ("version", "Print version number and exit")
+            ("i,infile", "The two outputs to compare, the reference first. mzML, or CSV for any other extension", cxxopts::value<vector<string>>())
+            ("abs-tol", "Absolute score error allowed, a point fails only outside both tolerances. Defaults to " + to_string(default_compare_abs_tol), cxxopts::value<double>())
+            ("rel-tol", "Score error allowed relative to the larger score. Defaults to " + to_string(default_compare_rel_tol), cxxopts::value<double>())
+            ("max-zero-mismatches", "Points allowed a zero score in one output and not the other. Defaults to 0", cxxopts::value<size_t>())
+            ("max-errors", "Points allowed outside the tolerances. Defaults to 0", cxxopts::value<size_t>())
+            ("score-column", "Column of the score in CSV outputs, from 1, after RT and M/Z. Defaults to 3, as '--listmax' writes", cxxopts::value<int>())
+            ("show", "Number of failing points to print. Defaults to 10", cxxopts::value<size_t>());
+        options.parse_positional({"infile"});
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help") or argc <= 1) {
+            cout << options.help() << endl;
+            exit(0);
+        }
+        if (result.count("version")) {
+            cout << program_name << " version " << HITIME_VERSION << endl;
+            exit(0);
+        }
+        if (result.count("infile"))
+            in_files = result["infile"].as<vector<string>>();
+        if (in_files.size() != 2) {
+            cerr << program_name << " ERROR: two outputs to compare are required" << endl;
+            exit(-1);
+        }
+        if (result.count("abs-tol"))
+            tolerances.abs_tol = result["abs-tol"].as<double>();
+        if (result.count("rel-tol"))
+            tolerances.rel_tol = result["rel-tol"].as<double>();
+        if (result.count("max-zero-mismatches"))
+            tolerances.max_zero_mismatches = result["max-zero-mismatches"].as<size_t>();
+        if (result.count("max-errors"))
+            tolerances.max_errors = result["max-errors"].as<size_t>();
+        if (result.count("score-column")) {
+            tolerances.score_column = result["score-column"].as<int>();
+            if (tolerances.score_column < 3) {
+                cerr << program_name << " ERROR: the score column must come after RT and M/Z, from column 3" << endl;
+                exit(-1);
+            }
+        }
+        if (result.count("show"))
+            tolerances.show = result["show"].as<size_t>();
+        if (tolerances.abs_tol < 0.0 or tolerances.rel_tol < 0.0) {
+            cerr << program_name << " ERROR: tolerances may not be negative" << endl;
+            exit(-1);
+        }
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+        std::cout << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
+
+    // exit status 1 if the outputs differ, for scripts
+    bool pass = false;
+    try
+    {
+        pass = compare_outputs(in_files[0], in_files[1], tolerances, cout);
+    }
+    catch (const exception &e)
+    {
+        cerr << program_name << " ERROR: " << e.what() << endl;
+        exit(-1);
+    }
+    return pass ? 0 : 1;
+}
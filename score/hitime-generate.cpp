@@ -0,0 +1,158 @@
+#include <OpenMS/FORMAT/DATAACCESS/MSDataWritingConsumer.h>
+#include <OpenMS/KERNEL/MSSpectrum.h>
+#include <OpenMS/METADATA/Precursor.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "constants.h"
+#include "cxxopts.h"
+#include "synthetic.h"
+#include "version.h"
+
+using namespace OpenMS;
+using namespace std;
+
+/*! Write a synthetic run as indexed mzML, one spectrum at a time, and the
+ * injected pairs as CSV.
+ */
+static void write_run(const SyntheticRun &run, const string &out_file, const string &pairs_file, double mz_delta)
+{
+    PlainMSDataWritingConsumer writer(out_file);
+    writer.setExpectedSize(run.size(), 0);
+
+    for (size_t scan_id = 0; scan_id < run.size(); ++scan_id)
+    {
+        SyntheticScan scan = run.get_scan(scan_id);
+        PeakSpectrum spectrum;
+        spectrum.setRT(scan.rt);
+        spectrum.setMSLevel(scan.ms_level);
+        spectrum.setNativeID("scan=" + to_string(scan_id + 1));
+        if (scan.ms_level > 1)
+        {
+            Precursor precursor;
+            precursor.setMZ(scan.precursor_mz);
+            spectrum.getPrecursors().push_back(precursor);
+        }
+        spectrum.reserve(scan.mz.size());
+        for (size_t point = 0; point < scan.mz.size(); ++point)
+            spectrum.push_back(Peak1D(scan.mz[point], scan.amp[point]));
+        writer.consumeSpectrum(spectrum);
+    }
+
+    ofstream pairs_fs(pairs_file);
+    if (!pairs_fs)
+    {
+        cerr << program_name << " ERROR: cannot write " << pairs_file << endl;
+        exit(-1);
+    }
+    pairs_fs << "mz,heavy_mz,rt,ms1_spectrum,height" << endl;
+    for (auto &pair : run.get_pairs())
+    {
+        pairs_fs << pair.mz << "," << pair.mz + mz_delta << "," << pair.rt << ","
+                 << pair.apex << "," << pair.height << endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    string desc = "Generate a synthetic LC-MS run with twin ion pairs of known M/Z delta and ratio, for benchmarking HiTIME";
+    SyntheticParams params;
+    string out_file;
+
+    try {
+        cxxopts::Options options("hitime-generate", desc);
+        options.add_options()
+            ("h,help", "Show this help information.")
+            ("version", "Print version number and exit")
+            ("o,outfile", "Output mzML file. The pairs are written to the same name ending in _pairs.csv", cxxopts::value<string>())
+            ("scans", "Number of spectra, MS1 and MS2. Defaults to 1000", cxxopts::value<size_t>())
+            ("points", "Number of noise points in each MS1 spectrum. Defaults to 1400", cxxopts::value<size_t>())
+            ("profile", "Flag, sample ion peaks as profile points instead of centroids. Default: not set")
+            ("ms2", "Number of MS2 spectra after each MS1 spectrum. Defaults to 0", cxxopts::value<size_t>())
+            ("pairs", "Number of twin ion pairs. Defaults to 100", cxxopts::value<size_t>())
+            ("d,mzdelta", "M/Z delta of the heavier ion. Defaults to 6.0201", cxxopts::value<double>())
+            ("a,iratio", "Intensity of the heavier ion relative to the natural ion. Defaults to 1", cxxopts::value<double>())
+            ("mz-range", "M/Z range of the spectra, as lower:upper. Defaults to 100:1000", cxxopts::value<string>())
+            ("r,rtwidth", "Retention time FWHM of the ions, in MS1 spectra. Defaults to 17", cxxopts::value<double>())
+            ("m,mzwidth", "M/Z FWHM of the ions, in PPM. Defaults to 150", cxxopts::value<double>())
+            ("scan-time", "Retention time between spectra, in seconds. Defaults to 1", cxxopts::value<double>())
+            ("height", "Largest apex intensity of a natural ion. Defaults to 1e6", cxxopts::value<double>())
+            ("noise", "Median intensity of the noise points. Defaults to 1000", cxxopts::value<double>())
+            ("seed", "Random seed. Defaults to 1", cxxopts::value<unsigned>());
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help") or argc <= 1) {
+            cout << options.help() << endl;
+            exit(0);
+        }
+        if (result.count("version")) {
+            cout << program_name << " version " << HITIME_VERSION << endl;
+            exit(0);
+        }
+        if (!result.count("outfile")) {
+            cerr << program_name << " ERROR: an output file is required" << endl;
+            exit(-1);
+        }
+        out_file = result["outfile"].as<string>();
+        if (result.count("scans"))
+            params.scans = result["scans"].as<size_t>();
+        if (result.count("points"))
+            params.points = result["points"].as<size_t>();
+        if (result.count("profile"))
+            params.profile = true;
+        if (result.count("ms2"))
+            params.ms2_per_ms1 = result["ms2"].as<size_t>();
+        if (result.count("pairs"))
+            params.pairs = result["pairs"].as<size_t>();
+        if (result.count("mzdelta"))
+            params.mz_delta = result["mzdelta"].as<double>();
+        if (result.count("iratio"))
+            params.ratio = result["iratio"].as<double>();
+        if (result.count("mz-range"))
+        {
+            string range = result["mz-range"].as<string>();
+            if (sscanf(range.c_str(), "%lf:%lf", &params.mz_lower, &params.mz_upper) != 2)
+            {
+                cerr << program_name << " ERROR: --mz-range must be lower:upper" << endl;
+                exit(-1);
+            }
+        }
+        if (result.count("rtwidth"))
+            params.rt_width = result["rtwidth"].as<double>();
+        if (result.count("mzwidth"))
+            params.mz_width = result["mzwidth"].as<double>();
+        if (result.count("scan-time"))
+            params.scan_time = result["scan-time"].as<double>();
+        if (result.count("height"))
+            params.height = result["height"].as<double>();
+        if (result.count("noise"))
+            params.noise = result["noise"].as<double>();
+        if (result.count("seed"))
+            params.seed = result["seed"].as<unsigned>();
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+        std::cout << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
+
+    if (params.mz_upper - params.mz_delta <= params.mz_lower or params.rt_width <= 0.0
+        or params.mz_width <= 0.0 or params.noise <= 0.0)
+    {
+        cerr << program_name << " ERROR: the M/Z range must be wider than the M/Z delta, and the widths and noise positive" << endl;
+        exit(-1);
+    }
+
+    size_t dot = out_file.find_last_of('.');
+    string pairs_file = (dot == string::npos ? out_file : out_file.substr(0, dot)) + "_pairs.csv";
+
+    SyntheticRun run(params);
+    write_run(run, out_file, pairs_file, params.mz_delta);
+
+    // summary for scripts, such as scripts/benchmark_e2e.sh
+    cout << "spectra " << run.size() << endl;
+    cout << "ms1_spectra " << run.ms1_size() << endl;
+    cout << "pairs " << run.get_pairs().size() << endl;
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "constants.h"
+#include "cxxopts.h"
+#include "merge.h"
+#include "version.h"
+
+using namespace std;
+
+int main(int argc, char** argv)
+{
+    string desc = "Merge the outputs of HiTIME runs over consecutive spectrum ranges ('--spectrum-range') into the output of a single run";
+    vector<string> in_files;
+    string out_file;
+
+    try {
+        cxxopts::Options options("hitime-merge", desc);
+        options.positional_help("partition_1 partition_2 ...");
+        options.add_options()
+            ("h,help", "Show this help information.")
+            ("version", "Print version number and exit")
+            ("o,outfile", "Merged output file, mzML or CSV by extension", cxxopts::value<string>())
+            ("i,infile", "Partition outputs, in spectrum range order", cxxopts::value<vector<string>>());
+        options.parse_positional({"infile"});
+
+        auto result = options.parse(argc, argv);
+
+        if (result.count("help") or argc <= 1) {
+            cout << options.help() << endl;
+            exit(0);
+        }
+        if (result.count("version")) {
+            cout << program_name << " version " << HITIME_VERSION << endl;
+            exit(0);
+        }
+        if (!result.count("outfile") or !result.count("infile")) {
+            cerr << program_name << " ERROR: an output file and at least one partition are required" << endl;
+            exit(-1);
+        }
+        out_file = result["outfile"].as<string>();
+        in_files = result["infile"].as<vector<string>>();
+    }
+    catch (const cxxopts::OptionException& e)
+    {
+        std::cout << "error parsing options: " << e.what() << std::endl;
+        exit(1);
+    }
+
+    try
+    {
+        size_t dot = out_file.find_last_of('.');
+        if (dot != string::npos and out_file.substr(dot) == ".csv")
+            merge_csv_files(in_files, out_file);
+        else
+            merge_mzml_files(in_files, out_file);
+    }
+    catch (const exception &e)
+    {
+        cerr << program_name << " ERROR: " << e.what() << endl;
+        exit(-1);
+    }
+
+    return 0;
+}
@@ -1,11 +1,46 @@
+#include <iostream>
+#include <stdexcept>
+#include "constants.h"
 #include "options.h"
 #include "score.h"
+#include "batch.h"
+#include "server.h"
 
 int main(int argc, char** argv)
 {
-   Options opts(argc, argv);
-   Scorer scorer(opts.debug, opts.list_max, opts.intensity_ratio, opts.rt_width,
-      opts.mz_width, opts.mz_delta, opts.confidence,
-      opts.num_threads, opts.input_spectrum_cache_size, opts.in_file, opts.out_file);
+   try
+   {
+      Options opts(argc, argv);
+      if (opts.serve_socket != "")
+      {
+         Server server(opts);
+         server.run();
+      }
+      else if (opts.batch_file != "")
+      {
+         Batch batch(opts);
+         batch.run();
+      }
+      else
+      {
+         Scorer scorer(opts);
+         scorer.run();
+      }
+   }
+   catch (const OptionsExit &e)
+   {
+      cout << e.what() << endl;
+      exit(e.status);
+   }
+   catch (const OptionsError &e)
+   {
+      cout << e.what() << endl;
+      exit(1);
+   }
+   catch (const exception &e)
+   {
+      cerr << program_name << " ERROR: " << e.what() << endl;
+      exit(-1);
+   }
    return 0;
 }
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include "constants.h"
+#include "kernel.h"
+#include "lru_cache.h"
+#include "synthetic.h"
+#include "vector.h"
+
+/*
+ * Tests of the scoring kernels (kernel.h) and the spectrum cache
+ * (lru_cache.h), run by ctest. Like hitime-bench it uses only the
+ * OpenMS-free core, so it builds wherever hitime_core does. The windows
+ * are hand made, or taken from a synthetic run with twin ion pairs.
+ *
+ * Exits with the number of failed checks, zero if all pass.
+ */
+
+using namespace std;
+
+static int failures = 0;
+
+//! @brief Record a failed check if the condition is false.
+static void check(bool condition, const string &what)
+{
+    if (!condition)
+    {
+        cerr << program_name << " FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+//! @brief Test that two values agree to a relative tolerance.
+static bool near(double a, double b, double rel_tol)
+{
+    return fabs(a - b) <= rel_tol * max(fabs(a), fabs(b));
+}
+
+/*! The baseline twin ion combined correlation, kept as it was before
+ * scoring was generalised to multiplets, to check that a twin ion model
+ * still scores the same.
+ */
+static double baseline_combined_correlation(const double_vect &data_nat, const double_vect &data_iso,
+                const double_vect &shape_nat, const double_vect &shape_iso)
+{
+    // local copies
+    double_vect Xa (data_nat);
+    double_vect Xb (data_iso);
+    double_vect Ya (shape_nat);
+    double_vect Yb (shape_iso);
+
+    double EXa = std::accumulate(Xa.begin(), Xa.end(), 0.0) / Xa.size();
+    double EXb = std::accumulate(Xb.begin(), Xb.end(), 0.0) / Xb.size();
+    double EYa = std::accumulate(Ya.begin(), Ya.end(), 0.0) / Ya.size();
+    double EYb = std::accumulate(Yb.begin(), Yb.end(), 0.0) / Yb.size();
+
+    // Combined mean is mean of means
+    double EXab = 0.5 * (EXa + EXb);
+    double EYab = 0.5 * (EYa + EYb);
+
+    // Centre data in regions relative to combined means
+    for (auto& val : Xa) val -= EXab;
+    for (auto& val : Xb) val -= EXab;
+    for (auto& val : Ya) val -= EYab;
+    for (auto& val : Yb) val -= EYab;
+
+    double ECXaCYa = inner_product(Xa.begin(), Xa.end(), Ya.begin(), 0.0);
+    double ECXa2 = inner_product(Xa.begin(), Xa.end(), Xa.begin(), 0.0);
+    double ECXb2 = inner_product(Xb.begin(), Xb.end(), Xb.begin(), 0.0);
+    double ECXbCYb = inner_product(Xb.begin(), Xb.end(), Yb.begin(), 0.0);
+    double ECYa2 = inner_product(Ya.begin(), Ya.end(), Ya.begin(), 0.0);
+    double ECYb2 = inner_product(Yb.begin(), Yb.end(), Yb.begin(), 0.0);
+
+    // Combined COV, VAR as mean region COV and VAR
+    double cov_Xab = 0.5 * (ECXaCYa + ECXbCYb);
+    double var_Xab = 0.5 * (ECXa2 + ECXb2);
+    double var_Yab = 0.5 * (ECYa2 + ECYb2);
+
+    double correl = cov_Xab / std::sqrt(var_Xab * var_Yab);
+    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
+
+    return correl;
+}
+
+//! @brief Gaussian shape in the RT direction, as the Scorer builds it.
+static double_vect make_rt_shape(double rt_width, int half_window)
+{
+    double local_rt_sigma = rt_width / std_dev_in_fwhm;
+    double_vect rt_shape(2 * half_window + 1);
+    for (size_t i = 0; i < rt_shape.size(); ++i)
+    {
+        double pt = (double(i) - half_window) / local_rt_sigma;
+        rt_shape[i] = exp(-0.5 * pt * pt) / (local_rt_sigma * root2pi);
+    }
+    return rt_shape;
+}
+
+/*! collect_window_data takes the points within the bounds, both included,
+ * from the window rows only, with the model value of each, and agrees
+ * with count_window_data.
+ */
+static void test_collect_window_data(void)
+{
+    double_2d mz_vals = {{99.0, 100.0, 100.5, 101.0, 102.0},
+                         {100.2, 100.8},
+                         {},
+                         {100.0, 103.0}};
+    double_2d amp_vals = {{1.0, 2.0, 3.0, 4.0, 5.0},
+                          {6.0, 7.0},
+                          {},
+                          {8.0, 9.0}};
+    double_vect rt_shape = {0.5, 1.0, 0.25};
+    double centre = 100.5;
+    double sigma = 0.5;
+
+    double_vect data;
+    double_vect shape;
+    collect_window_data(2.0, rt_shape, 0, centre, sigma, mz_vals, amp_vals, 100.0, 101.0, false, data, shape);
+    check(data == double_vect({2.0, 3.0, 4.0, 6.0, 7.0}), "collect_window_data takes the points within both bounds");
+    check(count_window_data(0, rt_shape.size(), mz_vals, 100.0, 101.0) == data.size(),
+          "count_window_data agrees with collect_window_data");
+
+    // the model is the M/Z Gaussian density times the scaled RT shape
+    double offset = (100.2 - centre) / sigma;
+    double expected = exp(-0.5 * offset * offset) / (sigma * root2pi) * rt_shape[1] * 2.0;
+    check(shape.size() == data.size() && near(shape[3], expected, 1e-12), "collect_window_data profile model value");
+
+    // a centroid carries the unit height peak response
+    data.clear();
+    shape.clear();
+    collect_window_data(1.0, rt_shape, 0, centre, sigma, mz_vals, amp_vals, 100.0, 101.0, true, data, shape);
+    check(near(shape[1], rt_shape[0], 1e-12), "collect_window_data centroid model value");
+
+    // the window starts at first_row and stops at the last row
+    data.clear();
+    shape.clear();
+    collect_window_data(1.0, rt_shape, 1, centre, sigma, mz_vals, amp_vals, 100.0, 101.0, false, data, shape);
+    check(data == double_vect({6.0, 7.0, 8.0}), "collect_window_data starts the window at first_row");
+    check(count_window_data(1, rt_shape.size(), mz_vals, 100.0, 101.0) == data.size(),
+          "count_window_data agrees with collect_window_data from first_row");
+
+    // several points exactly on a bound are all taken, and all counted
+    double_2d dup_mz_vals = {{100.0, 100.0, 100.5, 101.0, 101.0, 101.0}};
+    double_2d dup_amp_vals = {{1.0, 2.0, 3.0, 4.0, 5.0, 6.0}};
+    data.clear();
+    shape.clear();
+    collect_window_data(1.0, rt_shape, 0, centre, sigma, dup_mz_vals, dup_amp_vals, 100.0, 101.0, false, data, shape);
+    check(data == dup_amp_vals[0], "collect_window_data takes every point on the bounds");
+    check(count_window_data(0, rt_shape.size(), dup_mz_vals, 100.0, 101.0) == data.size(),
+          "count_window_data counts every point on the bounds");
+
+    check(local_max_data(7.0, mz_vals, amp_vals, 100.2, 100.9), "local_max_data finds the maximum");
+    check(!local_max_data(6.0, mz_vals, amp_vals, 100.2, 100.9), "local_max_data finds a larger point");
+}
+
+//! correlation and combined_correlation against hand computed values.
+static void test_correlation(void)
+{
+    double_vect x = {1.0, 2.0, 3.0, 4.0};
+    double_vect y = {2.0, 4.0, 6.0, 8.0};
+    double_vect y_neg = {8.0, 6.0, 4.0, 2.0};
+    check(near(correlation(x, y), 1.0, 1e-12), "correlation of proportional data is one");
+    check(near(correlation(x, y_neg), -1.0, 1e-12), "correlation of reversed data is minus one");
+    check(correlation(double_vect{1.0}, double_vect{1.0}) == 0.0, "correlation of one point is zero");
+    check(correlation(x, double_vect(4, 1.0)) == 0.0, "correlation with a flat model is zero");
+
+    // one region is the plain correlation
+    double_vect z = {1.0, 3.0, 2.0, 5.0};
+    check(near(combined_correlation(double_2d{x}, double_2d{z}, 1), correlation(x, z), 1e-12),
+          "combined correlation of one region is the correlation");
+
+    // suppressing a region scales its model by 0.001
+    double_2d data = {x, z};
+    double_2d shape = {y, y_neg};
+    double_2d suppressed = {y, y_neg};
+    for (auto &val : suppressed[1]) val *= 0.001;
+    check(combined_correlation(data, shape, 2, 1) == combined_correlation(data, suppressed, 2),
+          "combined correlation suppresses a region");
+
+    // only the first regions are used
+    double_2d extra_data = {x, z, y};
+    double_2d extra_shape = {y, y_neg, x};
+    check(combined_correlation(extra_data, extra_shape, 2) == combined_correlation(data, shape, 2),
+          "combined correlation uses only the given regions");
+}
+
+//! Meng's Z against the published formula, and its bounds.
+static void test_mengZ(void)
+{
+    double rhoXY = 0.9;
+    double rhoXZ = 0.5;
+    double rhoYZ = 0.6;
+    size_t samples = 50;
+    double rm2 = 0.5 * (rhoXY * rhoXY + rhoXZ * rhoXZ);
+    double f = min(1.0, (1.0 - rhoYZ) / (2.0 * (1.0 - rm2)));
+    double h = (1.0 - f * rm2) / (1.0 - rm2);
+    double expected = (atanh(rhoXY) - atanh(rhoXZ)) * sqrt((samples - 3.0) / (2.0 * (1.0 - rhoYZ) * h));
+    check(near(mengZ(rhoXY, rhoXZ, rhoYZ, samples, 0.0), expected, 1e-12), "mengZ matches the formula");
+    check(mengZ(rhoXY, rhoXZ, rhoYZ, samples, 1.96) == mengZ(rhoXY, rhoXZ, rhoYZ, samples, 0.0),
+          "mengZ does not depend on the confidence");
+    check(mengZ(rhoXZ, rhoXY, rhoYZ, samples, 0.0) == 0.0, "mengZ is zero for a worse model");
+    check(mengZ(rhoXY, rhoXY, rhoYZ, samples, 0.0) == 0.0, "mengZ is zero for an equal model");
+    check(mengZ(rhoXY, rhoXZ, rhoYZ, 2 * samples, 0.0) > expected, "mengZ grows with the samples");
+}
+
+//! The cache evicts the least recently used entry, and get refreshes an entry.
+static void test_lru_cache(void)
+{
+    cache::lru_cache<int, string> lru(2);
+    lru.put(1, "one");
+    lru.put(2, "two");
+    check(lru.size() == 2 && lru.exists(1) && lru.exists(2), "lru_cache holds its capacity");
+
+    lru.get(1);
+    lru.put(3, "three");
+    check(lru.exists(1) && !lru.exists(2) && lru.exists(3), "lru_cache evicts the least recently used");
+
+    lru.put(1, "uno");
+    check(lru.size() == 2 && lru.get(1) == "uno", "lru_cache replaces an existing key");
+
+    bool thrown = false;
+    try
+    {
+        lru.get(2);
+    }
+    catch (const range_error &)
+    {
+        thrown = true;
+    }
+    check(thrown, "lru_cache throws for a missing key");
+}
+
+/*! A twin ion model scores the same as the baseline twin ion scoring, on
+ * the windows of the injected pairs of a synthetic run, and the same as
+ * the reference scoring of '--verify'.
+ */
+static void test_twin_ion_baseline(void)
+{
+    SyntheticParams synth;
+    synth.scans = 200;
+    synth.pairs = 10;
+    synth.profile = true;
+    SyntheticRun run(synth);
+
+    double_2d mz_vals;
+    double_2d amp_vals;
+    for (size_t scan_id = 0; scan_id < run.size(); ++scan_id)
+    {
+        SyntheticScan scan = run.get_scan(scan_id);
+        mz_vals.push_back(scan.mz);
+        amp_vals.push_back(scan.amp);
+    }
+
+    int half_window = int(ceil(default_rt_sigma * default_rt_width / std_dev_in_fwhm));
+    double_vect rt_shape = make_rt_shape(default_rt_width, half_window);
+    double mz_ppm_sigma = default_fwhm / (std_dev_in_fwhm * 1e6);
+    double lower_tol = 1.0 - default_mz_sigma * mz_ppm_sigma;
+    double upper_tol = 1.0 + default_mz_sigma * mz_ppm_sigma;
+    double min_sample = half_window;
+    double_vect offsets = {default_mz_delta};
+    double_vect ratios = {1.0};
+
+    size_t scored = 0;
+    for (const auto &pair : run.get_pairs())
+    {
+        if (pair.apex < size_t(half_window) or pair.apex + half_window >= run.size())
+            continue;
+        size_t first_row = pair.apex - half_window;
+
+        // the centre point is the profile point nearest the natural ion
+        const double_vect &centre_row = mz_vals[pair.apex];
+        auto nearest = lower_bound(centre_row.begin(), centre_row.end(), pair.mz);
+        if (nearest == centre_row.end())
+            continue;
+        double centre = *nearest;
+        double centre_iso = centre + default_mz_delta;
+
+        double_2d data(2);
+        double_2d shape(2);
+        collect_window_data(1.0, rt_shape, first_row, centre, centre * mz_ppm_sigma, mz_vals, amp_vals,
+                    centre * lower_tol, centre * upper_tol, false, data[0], shape[0]);
+        collect_window_data(default_intensity_ratio, rt_shape, first_row, centre_iso, centre_iso * mz_ppm_sigma,
+                    mz_vals, amp_vals, centre_iso * lower_tol, centre_iso * upper_tol, false, data[1], shape[1]);
+        if (data[0].size() < min_sample or data[1].size() < min_sample)
+            continue;
+        size_t samples = data[0].size() + data[1].size();
+
+        // the multiplet kernels
+        double correl_XY = combined_correlation(data, shape, 2);
+        double score = numeric_limits<double>::max();
+        for (int member = 0; member < 2; ++member)
+        {
+            score = min(score, mengZ(correl_XY, combined_correlation(data, shape, 2, member),
+                                     combined_correlation(shape, shape, 2, member), samples, 0.0));
+        }
+        score = max(0.0, score);
+
+        // the baseline twin ion formulas
+        double_vect iso_lower(shape[1]);
+        for (auto &val : iso_lower) val *= 0.001;
+        double_vect nat_lower(shape[0]);
+        for (auto &val : nat_lower) val *= 0.001;
+        double correl_XabYab = baseline_combined_correlation(data[0], data[1], shape[0], shape[1]);
+        double correl_XabYa_ = baseline_combined_correlation(data[0], data[1], shape[0], iso_lower);
+        double correl_YabYa_ = baseline_combined_correlation(shape[0], shape[1], shape[0], iso_lower);
+        double correl_XabY_b = baseline_combined_correlation(data[0], data[1], nat_lower, shape[1]);
+        double correl_YabY_b = baseline_combined_correlation(shape[0], shape[1], nat_lower, shape[1]);
+        double zABA0 = mengZ(correl_XabYab, correl_XabYa_, correl_YabYa_, samples, 0.0);
+        double zAB0B = mengZ(correl_XabYab, correl_XabY_b, correl_YabY_b, samples, 0.0);
+        double baseline = max(0.0, min(zABA0, zAB0B));
+
+        check(correl_XY == correl_XabYab, "twin ion correlation equals the baseline");
+        check(score == baseline, "twin ion score equals the baseline");
+
+        double reference = reference_score(rt_shape, first_row, mz_vals, amp_vals, centre, offsets, ratios,
+                    default_intensity_ratio, mz_ppm_sigma, lower_tol, upper_tol, min_sample, 0.0, false);
+        check(near(reference, score, 1e-9), "twin ion score equals the reference");
+        if (score > 0.0)
+            scored++;
+    }
+    check(scored > 0, "injected twin ion pairs score");
+}
+
+int main(void)
+{
+    test_collect_window_data();
+    test_correlation();
+    test_mengZ();
+    test_lru_cache();
+    test_twin_ion_baseline();
+
+    if (failures == 0)
+        cout << program_name << " tests passed" << endl;
+    return failures;
+}
@@ -0,0 +1,38 @@
+#ifndef HITIME_H
+#define HITIME_H
+
+/*! The HiTIME library, for scoring from other programs without files.
+ *
+ * Fill an Options (or parse a command line into one) and call
+ * build_models(). Construct a Scorer with a SpectrumSource, e.g. an
+ * ExperimentSource over spectra in memory, and a ScoreCallback to receive
+ * the scored spectra, then call run():
+ *
+ *    Options opts;
+ *    opts.mz_deltas = {6.0201};
+ *    opts.rt_width = 17;
+ *    opts.mz_width = 150;
+ *    opts.num_threads = 4;
+ *    opts.build_models();
+ *    Scorer scorer(opts, make_shared<ExperimentSource>(experiment),
+ *                  [&](Size output_idx, PeakSpectrum &scores) { ... });
+ *    scorer.run();
+ *
+ * To feed spectra one at a time instead, set opts.live, leave
+ * opts.in_file empty, call start(), pass each spectrum to
+ * add_live_spectrum() until it returns false, then call end_live_input()
+ * and wait().
+ *
+ * Errors in the options, input or output are thrown as std::runtime_error,
+ * and a command line that does not parse as OptionsError, one of them.
+ * Errors in the scoring threads are thrown again by run() or wait(). A
+ * command line with '--help' or '--version', or without the required
+ * options, throws OptionsExit with the usage text to print; nothing in the
+ * library ends the program.
+ */
+
+#include "options.h"
+#include "input.h"
+#include "score.h"
+
+#endif
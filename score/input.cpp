@@ -0,0 +1,79 @@
+#include <OpenMS/FORMAT/IndexedMzMLFileLoader.h>
+#include <sys/stat.h>
+#include <iostream>
+#include <stdexcept>
+#include "constants.h"
+#include "input.h"
+
+using namespace OpenMS;
+using namespace std;
+
+//! @brief Modification time of a file, zero if it cannot be read.
+static time_t modification_time(const string &file_name)
+{
+   struct stat file_stat;
+   if (stat(file_name.c_str(), &file_stat) != 0)
+      return 0;
+   return file_stat.st_mtime;
+}
+
+/*! Load the index of an indexed mzML file.
+ *
+ * @param in_file Path of the file.
+ * @param cache_size Number of decoded spectra to keep, zero to keep none.
+ */
+InputFile::InputFile(const string &in_file, size_t cache_size)
+   : in_file(in_file)
+   , modified(modification_time(in_file))
+   , cache_size(cache_size)
+   , decoded_cache(cache_size)
+{
+   IndexedMzMLFileLoader mzml;
+   if (!mzml.load(in_file, input_map))
+   {
+      throw runtime_error(string("could not load indexed mzML file ") + in_file);
+   }
+   meta_data = input_map.getMetaData();
+}
+
+/*! Decode a spectrum, or copy it from the cache.
+ *
+ * @param file_id Position of the spectrum in the file.
+ *
+ * @return The spectrum as stored in the file.
+ */
+PeakSpectrum InputFile::get_spectrum(Size file_id)
+{
+   input_lock.lock();
+   if (cache_size == 0)
+   {
+      PeakSpectrum spectrum = input_map.getSpectrum(file_id);
+      input_lock.unlock();
+      return spectrum;
+   }
+   if (!decoded_cache.exists(file_id))
+   {
+      decoded_cache.put(file_id, make_shared<PeakSpectrum>(input_map.getSpectrum(file_id)));
+   }
+   PeakSpectrumPtr spectrum_ptr = decoded_cache.get(file_id);
+   input_lock.unlock();
+   return *spectrum_ptr;
+}
+
+//! @brief Number of spectra in the file.
+Size InputFile::size(void)
+{
+   return input_map.getNrSpectra();
+}
+
+//! @brief Spectrum metadata from the index, without peaks. May be null.
+const PeakMap *InputFile::get_meta_data(void)
+{
+   return meta_data.get();
+}
+
+//! @brief True if the file has not been modified since it was loaded.
+bool InputFile::is_current(void)
+{
+   return modification_time(in_file) == modified;
+}
@@ -0,0 +1,82 @@
+#ifndef HITIME_INPUT_H
+#define HITIME_INPUT_H
+
+#include <OpenMS/KERNEL/OnDiscMSExperiment.h>
+#include <OpenMS/KERNEL/MSSpectrum.h>
+#include <OpenMS/KERNEL/MSExperiment.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <ctime>
+#include "lru_cache.h"
+
+using namespace OpenMS;
+using namespace std;
+
+typedef shared_ptr<PeakSpectrum> PeakSpectrumPtr;
+typedef cache::lru_cache<Int, PeakSpectrumPtr> SpectrumLRUCache;
+
+/*! A source of spectra to score.
+ *
+ * Implement this to score spectra held anywhere, e.g. by an OpenMS pipeline,
+ * without writing them to a file first.
+ */
+class SpectrumSource
+{
+public:
+   virtual ~SpectrumSource() {}
+   //! @brief Number of spectra.
+   virtual Size size(void) = 0;
+   //! @brief A spectrum, with its peaks. Called from several threads at once.
+   virtual PeakSpectrum get_spectrum(Size spectrum_id) = 0;
+   //! @brief Every spectrum without (or with) its peaks, used to select spectra. May be null.
+   virtual const PeakMap *get_meta_data(void) = 0;
+};
+
+typedef shared_ptr<SpectrumSource> SpectrumSourcePtr;
+
+/*! An indexed mzML input file.
+ *
+ * Holds the loaded index, and optionally keeps decoded spectra, as read
+ * from the file, in a cache of its own. A server shares one InputFile
+ * between the jobs on the same file, so later jobs skip the index load and
+ * find spectra already decoded. Safe to use from several threads.
+ */
+class InputFile : public SpectrumSource
+{
+private:
+   string in_file;
+   time_t modified; //!< Modification time of the file when it was loaded
+   OnDiscPeakMap input_map;
+   boost::shared_ptr<PeakMap> meta_data; //!< Spectrum metadata from the index
+   size_t cache_size; //!< Number of decoded spectra to keep, zero to keep none
+   SpectrumLRUCache decoded_cache;
+   mutex input_lock;
+
+public:
+   InputFile(const string &in_file, size_t cache_size = 0);
+   PeakSpectrum get_spectrum(Size file_id);
+   Size size(void);
+   const PeakMap *get_meta_data(void);
+   bool is_current(void);
+};
+
+typedef shared_ptr<InputFile> InputFilePtr;
+
+/*! Spectra already in memory, e.g. loaded or produced by an OpenMS pipeline.
+ *
+ * The experiment is not copied, it must outlive the source.
+ */
+class ExperimentSource : public SpectrumSource
+{
+private:
+   const PeakMap &experiment;
+
+public:
+   ExperimentSource(const PeakMap &experiment) : experiment(experiment) {}
+   Size size(void) { return experiment.size(); }
+   PeakSpectrum get_spectrum(Size spectrum_id) { return experiment[spectrum_id]; }
+   const PeakMap *get_meta_data(void) { return &experiment; }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef HITIME_JSON_H
+#define HITIME_JSON_H
+
+#include <cstdio>
+#include <string>
+
+/*! @brief Quote a string as a JSON string, escaping quotes, backslashes and
+ * control characters, e.g. file paths in the JSON reports.
+ */
+inline std::string json_string(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"': quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }
+            else
+            {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + "\"";
+}
+
+#endif
@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "constants.h"
+#include "kernel.h"
+
+using namespace std;
+
+/*! Gather the data points of one ion region in a window, with the model
+ * value of each point.
+ *
+ * @param scale Model intensity of the ion relative to the natural ion.
+ * @param rt_shape Gaussian shape in the RT direction, one value per row.
+ * @param first_row First row of the window in mz_vals and amp_vals.
+ * @param centre M/Z of the ion.
+ * @param sigma M/Z standard deviation of the ion peak.
+ * @param mz_vals M/Z of each point in each row, sorted.
+ * @param amp_vals Intensity of each point in each row.
+ * @param lower_bound_mz Lower bound of the ion region.
+ * @param upper_bound_mz Upper bound of the ion region.
+ * @param centroid True if the points are centroids rather than profile.
+ * @param data_out Intensities of the points are appended to this.
+ * @param shape_out Model values of the points are appended to this.
+ */
+void collect_window_data(double scale,
+               const double_vect & rt_shape, size_t first_row,
+               double centre, double sigma,
+               const double_2d & mz_vals, const double_2d & amp_vals,
+               double lower_bound_mz, double upper_bound_mz, bool centroid,
+               double_vect & data_out, double_vect & shape_out)
+{
+    // Iterate over the spectra in the window, which starts at first_row
+    // of the collected rows
+    for (size_t shapei = 0; shapei < rt_shape.size() && first_row + shapei < mz_vals.size(); ++shapei)
+    {
+        size_t rowi = first_row + shapei;
+        double rt_shape_i = rt_shape[shapei] * scale;
+        // Select points within tolerance for current spectrum, the first
+        // at or above the lower bound up to the last at or below the upper
+        auto row_begin = mz_vals[rowi].begin();
+        auto lower = std::lower_bound(row_begin, mz_vals[rowi].end(), lower_bound_mz);
+        auto upper = std::upper_bound(lower, mz_vals[rowi].end(), upper_bound_mz);
+        size_t lower_index = size_t(lower - row_begin);
+        size_t upper_index = size_t(upper - row_begin);
+
+        // Calculate Gaussian value for each found MZ
+        for (size_t index = lower_index; index < upper_index; ++index)
+        {
+            double mz = mz_vals[rowi][index];
+            double intensity = amp_vals[rowi][index];
+
+            // calc mz fit
+            // A profile point samples the peak density at its M/Z, whereas
+            // a centroid carries the whole peak, so its expected intensity
+            // is the (unit height) peak response at its offset
+            mz = (mz - centre) / sigma;
+            mz = -0.5 * mz * mz;
+            double fit = centroid ? exp(mz) : exp(mz) / (sigma * root2pi);
+
+            data_out.push_back(intensity);
+            shape_out.push_back(fit * rt_shape_i);
+        }
+    }
+}
+
+/*! Count the points collect_window_data would gather, without computing
+ * the model.
+ *
+ * @return Number of points within the M/Z bounds in the window rows.
+ */
+size_t count_window_data(size_t first_row, size_t rows,
+               const double_2d & mz_vals,
+               double lower_bound_mz, double upper_bound_mz)
+{
+    size_t count = 0;
+    for (size_t rowi = first_row; rowi < first_row + rows && rowi < mz_vals.size(); ++rowi)
+    {
+        // the same points as collect_window_data, both bounds included
+        auto lower = std::lower_bound(mz_vals[rowi].begin(), mz_vals[rowi].end(), lower_bound_mz);
+        auto upper = std::upper_bound(lower, mz_vals[rowi].end(), upper_bound_mz);
+        count += upper - lower;
+    }
+    return count;
+}
+
+//! @brief Largest intensity within M/Z bounds in one spectrum row.
+static double max_row_intensity(const double_vect &mz_row, const double_vect &amp_row,
+               double lower_bound_mz, double upper_bound_mz)
+{
+    double max_amp = 0.0;
+    size_t index = std::lower_bound(mz_row.begin(), mz_row.end(), lower_bound_mz) - mz_row.begin();
+    for (; index < mz_row.size() && mz_row[index] <= upper_bound_mz; ++index)
+    {
+        max_amp = std::max(max_amp, amp_row[index]);
+    }
+    return max_amp;
+}
+
+/*! Cheap first stage screen of a centre point against an ion model.
+ *
+ * Compares the largest intensity of each ion region in the centre spectrum
+ * only with the intensity the model expects from the natural ion.
+ *
+ * @return Agreement between 0 (an ion missing) and 1 (exactly the model
+ * ratios), the smallest over the heavier ions.
+ */
+double screen_centre_row(const double_vect &mz_row, const double_vect &amp_row,
+               double centre, const double_vect &offsets, const double_vect &ratios,
+               double intensity_ratio, double lower_tol, double upper_tol)
+{
+    double nat = max_row_intensity(mz_row, amp_row, centre * lower_tol, centre * upper_tol);
+    double agreement = 1.0;
+
+    for (size_t member = 0; member < offsets.size(); ++member)
+    {
+        double centre_iso = centre + offsets[member];
+        double expected = nat * ratios[member] * intensity_ratio;
+        double observed = max_row_intensity(mz_row, amp_row, centre_iso * lower_tol, centre_iso * upper_tol);
+        if (expected <= 0.0 or observed <= 0.0)
+            return 0.0;
+        agreement = std::min({agreement, observed / expected, expected / observed});
+    }
+    return agreement;
+}
+
+/*! Correlation between data and model over one ion region.
+ *
+ * @return The correlation, or zero if undefined.
+ */
+double correlation(const double_vect &data, const double_vect &shape)
+{
+    // Zero correlation if not enough data in either region
+    if (data.size() < 2 or shape.size() < 2) return 0.0;
+
+    // local copies
+    double_vect X (data);
+    double_vect Y (shape);
+
+    double EX = std::accumulate(X.begin(), X.end(), 0.0) / X.size();
+    double EY = std::accumulate(Y.begin(), Y.end(), 0.0) / Y.size();
+
+    // Centre data in regions relative to combined means
+    for (auto& val : X) val -= EX;
+    for (auto& val : Y) val -= EY;
+
+    // COV and VAR
+    double COV = inner_product(X.begin(), X.end(), Y.begin(), 0.0);
+    double VARX = inner_product(X.begin(), X.end(), X.begin(), 0.0);
+    double VARY = inner_product(Y.begin(), Y.end(), Y.begin(), 0.0);
+
+    double correl = COV / std::sqrt(VARX * VARY);
+    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
+
+    return correl;
+}
+
+/*! Correlation between data and model over several ion regions.
+ *
+ * Each region is centred relative to the combined means (the mean of the
+ * region means) and the combined covariance and variances are the mean of
+ * the region values.
+ *
+ * @param data Data points in each region.
+ * @param shape Model values for each data point in each region.
+ * @param regions Number of regions to use, from the start of data and shape.
+ * @param suppressed Region whose model is scaled down to (nearly) zero to
+ * form an alternate model, or -1 to use the model unchanged.
+ *
+ * @return The combined correlation, or zero if undefined.
+ */
+double combined_correlation(const double_2d &data, const double_2d &shape,
+                size_t regions, int suppressed)
+{
+    // local copies
+    double_2d X (data.begin(), data.begin() + regions);
+    double_2d Y (shape.begin(), shape.begin() + regions);
+
+    if (suppressed >= 0)
+    {
+        for (auto& val : Y[suppressed]) val *= 0.001;
+    }
+
+    // Combined mean is mean of means
+    double EX = 0.0;  // E(X) =  E(E(Xa), E(Xb), ...)
+    double EY = 0.0;  // E(Y) =  E(E(Ya), E(Yb), ...)
+    for (size_t region = 0; region < regions; ++region)
+    {
+        EX += std::accumulate(X[region].begin(), X[region].end(), 0.0) / X[region].size();
+        EY += std::accumulate(Y[region].begin(), Y[region].end(), 0.0) / Y[region].size();
+    }
+    EX /= regions;
+    EY /= regions;
+
+    // region expected values
+    // E((Xa - E(X))(Ya - E(Y)))
+    // E((Xa - E(X))^2)
+    // E((Ya - E(Y))^2)
+    double ECXCY = 0.0;
+    double ECX2 = 0.0;
+    double ECY2 = 0.0;
+    for (size_t region = 0; region < regions; ++region)
+    {
+        // Centre data in regions relative to combined means
+        for (auto& val : X[region]) val -= EX;  // (Xa - E(X)) --> C(Xa)
+        for (auto& val : Y[region]) val -= EY;  // (Ya - E(Y))
+
+        ECXCY += inner_product(X[region].begin(), X[region].end(), Y[region].begin(), 0.0);
+        ECX2 += inner_product(X[region].begin(), X[region].end(), X[region].begin(), 0.0);
+        ECY2 += inner_product(Y[region].begin(), Y[region].end(), Y[region].begin(), 0.0);
+    }
+
+    // Combined COV, VAR as mean region COV and VAR
+    double cov_X = ECXCY / regions;
+    double var_X = ECX2 / regions;
+    double var_Y = ECY2 / regions;
+
+    double correl = cov_X / std::sqrt(var_X * var_Y);
+    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
+
+    return correl;
+}
+
+/*
+ * Calculate Meng's Z-score
+ * Meng, Rubin, & Rosenthal (1992),
+ * Comparing Correlated Correlation Coefficients,
+ * Psychological Bulletin 111(1), 172-175.
+ */
+double mengZ(double rhoXY, double rhoXZ, double rhoYZ, size_t samples, double confidence)
+{
+        // Calculate rm values between correlations
+        double rm2 = 0.5 * (rhoXY * rhoXY + rhoXZ * rhoXZ);
+    
+        // Calculate f values between correlation and rm
+        double f = (1.0 - rhoYZ) / (2.0 * (1.0 - rm2));
+        if (std::isinf(f) or f > 1.0) f = 1.0;
+    
+        // Calculate h values between f and rm
+        double h = (1.0 - f * rm2) / (1.0 - rm2);
+    
+        // Calculate z scores
+        double z = (std::atanh(rhoXY) - std::atanh(rhoXZ)) *
+                std::sqrt( (samples - 3.0) / (2.0 * (1.0 - rhoYZ) * h) );
+        if (std::isnan(z) or std::isinf(z) or z < 0.0) z = 0.0;
+        if (confidence > 0.0) {
+            // Only use score if lower confidence greater than zero
+            double lCI = (std::atanh(rhoXY) - std::atanh(rhoXZ)) - confidence *
+                    std::sqrt((2.0 * (1.0 - rhoYZ) * h) / (samples - 3.0));
+            if (std::isnan(lCI) or std::isinf(lCI) or lCI < 0.0) lCI = 0.0;
+            if (lCI > 0.0) return z;
+        }
+
+        return z;
+}
+
+/*
+ * The reference scoring used by '--verify' is a separate, plain copy of the
+ * baseline twin-ion maths, extended to any number of ions. It shares no code
+ * with the scoring path above, so that a change to the scoring path cannot
+ * change the reference it is checked against.
+ */
+
+//! @brief Points of one ion region in a window, found by scanning each whole row.
+static void reference_region(double scale, const double_vect &rt_shape, size_t first_row,
+               double centre, double sigma, const double_2d &mz_vals, const double_2d &amp_vals,
+               double lower_bound_mz, double upper_bound_mz, bool centroid,
+               double_vect &data, double_vect &shape)
+{
+    for (size_t shapei = 0; shapei < rt_shape.size() && first_row + shapei < mz_vals.size(); ++shapei)
+    {
+        size_t rowi = first_row + shapei;
+        for (size_t index = 0; index < mz_vals[rowi].size(); ++index)
+        {
+            double mz = mz_vals[rowi][index];
+            if (mz < lower_bound_mz || mz > upper_bound_mz) continue;
+
+            double offset = (mz - centre) / sigma;
+            double fit = exp(-0.5 * offset * offset);
+            if (!centroid) fit /= sigma * root2pi;
+            data.push_back(amp_vals[rowi][index]);
+            shape.push_back(fit * rt_shape[shapei] * scale);
+        }
+    }
+}
+
+//! @brief Mean of the values, NaN if there are none.
+static double reference_mean(const double_vect &values)
+{
+    double sum = 0.0;
+    for (double value : values) sum += value;
+    return sum / values.size();
+}
+
+/*! Correlation between data and model over the ion regions, each region
+ * centred on the mean of the region means, as in the baseline.
+ *
+ * @param suppressed Region whose model is scaled by 0.001 to form an
+ * alternate model, or -1 for none.
+ *
+ * @return The correlation, or zero if undefined.
+ */
+static double reference_correlation(const double_2d &data, const double_2d &shape, int suppressed)
+{
+    size_t regions = data.size();
+    double suppress_scale = 0.001;
+    double mean_X = 0.0;
+    double mean_Y = 0.0;
+    for (size_t region = 0; region < regions; ++region)
+    {
+        double scale = int(region) == suppressed ? suppress_scale : 1.0;
+        mean_X += reference_mean(data[region]);
+        mean_Y += reference_mean(shape[region]) * scale;
+    }
+    mean_X /= regions;
+    mean_Y /= regions;
+
+    double cov = 0.0;
+    double var_X = 0.0;
+    double var_Y = 0.0;
+    for (size_t region = 0; region < regions; ++region)
+    {
+        double scale = int(region) == suppressed ? suppress_scale : 1.0;
+        for (size_t i = 0; i < data[region].size(); ++i)
+        {
+            double x = data[region][i] - mean_X;
+            double y = shape[region][i] * scale - mean_Y;
+            cov += x * y;
+            var_X += x * x;
+            var_Y += y * y;
+        }
+    }
+
+    double correl = (cov / regions) / std::sqrt((var_X / regions) * (var_Y / regions));
+    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
+    return correl;
+}
+
+/*! Meng's Z-score of a correlation rhoXY over an alternate rhoXZ, where
+ * rhoYZ correlates the two models (Meng, Rubin and Rosenthal, 1992).
+ *
+ * @return The Z-score, zero if negative or undefined.
+ */
+static double reference_meng_z(double rhoXY, double rhoXZ, double rhoYZ, size_t samples)
+{
+    double rm2 = 0.5 * (rhoXY * rhoXY + rhoXZ * rhoXZ);
+    double f = (1.0 - rhoYZ) / (2.0 * (1.0 - rm2));
+    if (std::isinf(f) or f > 1.0) f = 1.0;
+    double h = (1.0 - f * rm2) / (1.0 - rm2);
+    double z = (std::atanh(rhoXY) - std::atanh(rhoXZ))
+               * std::sqrt((samples - 3.0) / (2.0 * (1.0 - rhoYZ) * h));
+    if (std::isnan(z) or std::isinf(z) or z < 0.0) z = 0.0;
+    return z;
+}
+
+/*! Score one centre point against one ion model the plain way, as a
+ * check of the scoring path ('--verify'). Every ion region is collected
+ * afresh by scanning whole rows, without the shortcuts of the scoring
+ * path: binary searches of the rows, counting region points before
+ * collecting them, sharing the natural ion region between models, and
+ * screening on the centre row.
+ *
+ * @param rt_shape Gaussian shape in the RT direction, one value per row.
+ * @param first_row First row of the window in mz_vals and amp_vals.
+ * @param mz_vals M/Z of each point in each row, sorted.
+ * @param amp_vals Intensity of each point in each row.
+ * @param centre M/Z of the natural ion.
+ * @param offsets M/Z offset of each other ion of the model.
+ * @param ratios Intensity of each other ion relative to the natural ion.
+ * @param intensity_ratio Overall intensity ratio of the parameter set.
+ * @param mz_ppm_sigma M/Z standard deviation of an ion peak per unit M/Z.
+ * @param lower_tol Lower bound of an ion region relative to its M/Z.
+ * @param upper_tol Upper bound of an ion region relative to its M/Z.
+ * @param min_sample Fewest points each ion region needs to score.
+ * @param confidence Confidence of the lower bound each region's
+ * correlation must clear, zero for none.
+ * @param centroid True if the points are centroids rather than profile.
+ *
+ * @return The smallest Meng's Z over the alternate models, at least zero.
+ */
+double reference_score(const double_vect &rt_shape, size_t first_row,
+               const double_2d &mz_vals, const double_2d &amp_vals,
+               double centre, const double_vect &offsets, const double_vect &ratios,
+               double intensity_ratio, double mz_ppm_sigma, double lower_tol, double upper_tol,
+               double min_sample, double confidence, bool centroid)
+{
+    size_t regions = offsets.size() + 1;
+    double_2d data(regions);
+    double_2d shape(regions);
+    size_t samples = 0;
+
+    for (size_t member = 0; member < regions; ++member)
+    {
+        double member_centre = member == 0 ? centre : centre + offsets[member - 1];
+        double scale = member == 0 ? 1.0 : ratios[member - 1] * intensity_ratio;
+        reference_region(scale, rt_shape, first_row, member_centre, member_centre * mz_ppm_sigma,
+                    mz_vals, amp_vals, member_centre * lower_tol, member_centre * upper_tol,
+                    centroid, data[member], shape[member]);
+        if (data[member].size() < min_sample)
+            return 0.0;
+
+        // each ion must correlate with its model on its own, with the lower
+        // confidence bound over the natural ion sample size as in the baseline
+        if (confidence > 0.0)
+        {
+            double correl = data[member].size() < 2 ? 0.0
+                : reference_correlation(double_2d(1, data[member]), double_2d(1, shape[member]), -1);
+            double z1 = std::atanh(correl) - confidence / std::sqrt(data[0].size() - 3.0);
+            if (std::isnan(z1) or std::isinf(z1) or z1 <= 0.0)
+                return 0.0;
+        }
+        samples += data[member].size();
+    }
+
+    // the model against each alternate with one ion suppressed
+    double correl_XY = reference_correlation(data, shape, -1);
+    double min_score = numeric_limits<double>::max();
+    for (size_t member = 0; member < regions; ++member)
+    {
+        double correl_XY_ = reference_correlation(data, shape, member);
+        double correl_YY_ = reference_correlation(shape, shape, member);
+        min_score = min(min_score, reference_meng_z(correl_XY, correl_XY_, correl_YY_, samples));
+    }
+    return max(0.0, min_score);
+}
+
+/*! Test whether no point within M/Z bounds in any row of a window is
+ * more intense than the centre point.
+ */
+bool local_max_data(double centre_amp,
+               const double_2d & mz_vals, const double_2d & amp_vals,
+               double lower_bound_mz, double upper_bound_mz)
+{
+    // Iterate over the spectra in the window
+    for (size_t rowi = 0; rowi < mz_vals.size(); ++rowi)
+    {
+        // Select points within tolerance for current spectrum, the first
+        // at or above the lower bound up to the last at or below the upper
+        auto row_begin = mz_vals[rowi].begin();
+        auto lower = std::lower_bound(row_begin, mz_vals[rowi].end(), lower_bound_mz);
+        auto upper = std::upper_bound(lower, mz_vals[rowi].end(), upper_bound_mz);
+        size_t lower_index = size_t(lower - row_begin);
+        size_t upper_index = size_t(upper - row_begin);
+
+        // fail if larger value found
+        for (size_t index = lower_index; index < upper_index; ++index)
+        {
+            if (amp_vals[rowi][index] > centre_amp)
+                return false;
+        }
+    }
+    return true;  // nothing greater found
+}
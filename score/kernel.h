@@ -0,0 +1,53 @@
+#ifndef HITIME_KERNEL_H
+#define HITIME_KERNEL_H
+
+/*
+ * The numeric core of HiTIME scoring, over plain vectors of M/Z and
+ * intensity values. It does not depend on OpenMS, so it can be built,
+ * tested and benchmarked on its own (the hitime_core library).
+ */
+
+#include <cstddef>
+#include "vector.h"
+
+//! @brief Gather the data points and model values of one ion region in a window.
+void collect_window_data(double scale,
+               const double_vect & rt_shape, size_t first_row,
+               double centre, double sigma,
+               const double_2d & mz_vals, const double_2d & amp_vals,
+               double lower_bound_mz, double upper_bound_mz, bool centroid,
+               double_vect & data_out, double_vect & shape_out);
+
+//! @brief Count the points collect_window_data would gather.
+size_t count_window_data(size_t first_row, size_t rows,
+               const double_2d & mz_vals,
+               double lower_bound_mz, double upper_bound_mz);
+
+//! @brief Cheap screen of a centre point against an ion model on the centre row only.
+double screen_centre_row(const double_vect &mz_row, const double_vect &amp_row,
+               double centre, const double_vect &offsets, const double_vect &ratios,
+               double intensity_ratio, double lower_tol, double upper_tol);
+
+//! @brief Correlation between data and model over one ion region.
+double correlation(const double_vect &data, const double_vect &shape);
+
+//! @brief Correlation between data and model over several ion regions.
+double combined_correlation(const double_2d &data, const double_2d &shape,
+                size_t regions, int suppressed = -1);
+
+//! @brief Meng's Z-score comparing two correlated correlations.
+double mengZ(double rhoXY, double rhoXZ, double rhoYZ, size_t samples, double confidence);
+
+//! @brief Score one centre point against one ion model, without the shortcuts of the scoring path.
+double reference_score(const double_vect &rt_shape, size_t first_row,
+               const double_2d &mz_vals, const double_2d &amp_vals,
+               double centre, const double_vect &offsets, const double_vect &ratios,
+               double intensity_ratio, double mz_ppm_sigma, double lower_tol, double upper_tol,
+               double min_sample, double confidence, bool centroid);
+
+//! @brief Test whether the centre point is the most intense in its window.
+bool local_max_data(double centre_amp,
+               const double_2d & mz_vals, const double_2d & amp_vals,
+               double lower_bound_mz, double upper_bound_mz);
+
+#endif
@@ -0,0 +1,70 @@
+#include <OpenMS/FORMAT/IndexedMzMLFileLoader.h>
+#include <OpenMS/FORMAT/DATAACCESS/MSDataWritingConsumer.h>
+#include <OpenMS/KERNEL/OnDiscMSExperiment.h>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include "constants.h"
+#include "merge.h"
+
+using namespace OpenMS;
+using namespace std;
+
+/*! Concatenate CSV files, such as the outputs of runs over consecutive
+ * spectrum ranges.
+ *
+ * @param in_files Files to concatenate, in order.
+ * @param out_file Merged output file.
+ */
+void merge_csv_files(const vector<string> &in_files, const string &out_file)
+{
+    ofstream out_fs(out_file);
+    out_fs.exceptions(ofstream::badbit | ofstream::failbit);
+
+    for (auto &in_file : in_files)
+    {
+        ifstream in_fs(in_file);
+        if (!in_fs)
+        {
+            throw runtime_error(string("could not open ") + in_file);
+        }
+        string line;
+        while (getline(in_fs, line))
+        {
+            out_fs << line << endl;
+        }
+    }
+}
+
+/*! Concatenate the spectra of indexed mzML files, such as the outputs of
+ * runs over consecutive spectrum ranges.
+ *
+ * The spectra are written again rather than copied as text, so the merged
+ * file has one index over all spectra, and the same spectrum IDs, as a
+ * single run would.
+ *
+ * @param in_files Files to concatenate, in order.
+ * @param out_file Merged output file.
+ */
+void merge_mzml_files(const vector<string> &in_files, const string &out_file)
+{
+    PlainMSDataWritingConsumer writer(out_file);
+    IndexedMzMLFileLoader mzml;
+
+    for (auto &in_file : in_files)
+    {
+        OnDiscPeakMap part_map;
+        if (!mzml.load(in_file, part_map))
+        {
+            throw runtime_error(string("could not load indexed mzML file ") + in_file);
+        }
+        for (Size spectrum_id = 0; spectrum_id < part_map.getNrSpectra(); ++spectrum_id)
+        {
+            PeakSpectrum spectrum = part_map.getSpectrum(spectrum_id);
+            // each part was numbered from zero by its own writer, clear the
+            // ID so the merged writer numbers the spectra as a single run does
+            spectrum.setNativeID("");
+            writer.consumeSpectrum(spectrum);
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef HITIME_MERGE_H
+#define HITIME_MERGE_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//! @brief Concatenate CSV files, in order, into one file.
+void merge_csv_files(const vector<string> &in_files, const string &out_file);
+
+//! @brief Concatenate the spectra of indexed mzML files, in order, into one file.
+void merge_mzml_files(const vector<string> &in_files, const string &out_file);
+
+#endif
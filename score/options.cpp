@@ -1,5 +1,12 @@
 #include <iostream>
 #include <iterator>
+#include <cstdlib>
+#include <cctype>
+#include <sstream>
+#include <fstream>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
 #include "constants.h"
 #include "options.h"
 #include "cxxopts.h"
@@ -7,24 +14,371 @@
 
 using namespace std;
 
-Options::Options(int argc, char* argv[])
+/*! Split a comma separated list of values.
+ *
+ * @param list_str Values separated by commas, e.g. "6.0201,3.01005".
+ *
+ * @return Vector of the (non-empty) values in the list.
+ */
+static vector<string> split_list(const string &list_str)
+{
+    vector<string> items;
+    stringstream ss(list_str);
+    string item;
+
+    while (getline(ss, item, ','))
+    {
+        if (item != "")
+            items.push_back(item);
+    }
+
+    return items;
+}
+
+//! @brief Shortest text form of a number, e.g. 6.0201 rather than 6.020100.
+static string format_number(double value)
+{
+    ostringstream ss;
+    ss << value;
+    return ss.str();
+}
+
+/*! Parse a range given as "start:end".
+ *
+ * @param range_str The range text.
+ * @param start Set to the start of the range.
+ * @param end Set to the end of the range.
+ *
+ * @return True if the range is valid, with start less than end.
+ */
+static bool parse_range(const string &range_str, double &start, double &end)
+{
+    size_t colon = range_str.find(':');
+    if (colon == string::npos)
+        return false;
+    start = atof(range_str.substr(0, colon).c_str());
+    end = atof(range_str.substr(colon + 1).c_str());
+    return start < end;
+}
+
+/*! Read a batch manifest.
+ *
+ * Each non-blank line is "input,output", giving the input mzML file of one
+ * job and the output file it is scored into. Lines starting with '#' are
+ * ignored.
+ *
+ * @param batch_file Path of the manifest.
+ * @param jobs Filled with the input and output file of each job.
+ *
+ * @return An error message, empty if the manifest is valid.
+ */
+static string read_batch_file(const string &batch_file, vector<pair<string, string>> &jobs)
+{
+    ifstream batch_fs(batch_file);
+    if (!batch_fs)
+        return "cannot open batch manifest " + batch_file;
+
+    string line;
+    int line_num = 0;
+    while (getline(batch_fs, line))
+    {
+        line_num++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos or line[first] == '#')
+            continue;
+
+        size_t last = line.find_last_not_of(" \t\r");
+        vector<string> fields = split_list(line.substr(first, last - first + 1));
+        if (fields.size() != 2)
+            return "expected input,output on line " + to_string(line_num) + " of " + batch_file;
+        jobs.push_back(make_pair(fields[0], fields[1]));
+    }
+    if (jobs.empty())
+        return "no jobs in batch manifest " + batch_file;
+
+    return "";
+}
+
+/*! Parse a multiplet model description.
+ *
+ * @param model_str Comma separated list of "offset:ratio" pairs, one for each
+ * member heavier than the natural ion, e.g. "6.0201:1,12.0402:0.5".
+ * @param model Filled with the offsets and ratios of the members.
+ *
+ * @return True if the description is valid.
+ */
+static bool parse_multiplet(const string &model_str, IonModel &model)
+{
+    for (auto &member_str : split_list(model_str))
+    {
+        size_t colon = member_str.find(':');
+        double offset = atof(member_str.substr(0, colon).c_str());
+        double ratio = default_intensity_ratio;
+        if (colon != string::npos)
+            ratio = atof(member_str.substr(colon + 1).c_str());
+        if (offset <= 0 or ratio <= 0)
+            return false;
+        model.offsets.push_back(offset);
+        model.ratios.push_back(ratio);
+    }
+    return model.offsets.size() > 0;
+}
+
+/*! Read the parameter sets of a sweep from a grid file.
+ *
+ * Each line of the file gives one set as comma separated retention time
+ * width, M/Z width, intensity ratio and confidence, e.g. "17,150,1,1.96".
+ * The confidence may be left out (no confidence interval). Blank lines and
+ * lines starting with '#' or a column header are skipped.
+ *
+ * @param sweep_file Path to the grid file.
+ * @param param_sets Filled with one entry per line.
+ *
+ * @return Empty string on success, otherwise a description of the problem.
+ */
+static string read_sweep_file(const string &sweep_file, vector<ScoreParams> &param_sets)
+{
+    ifstream sweep_fs(sweep_file);
+    if (!sweep_fs)
+        return "cannot open parameter sweep file " + sweep_file;
+
+    string line;
+    int line_num = 0;
+    while (getline(sweep_fs, line))
+    {
+        line_num++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos or line[first] == '#' or isalpha(line[first]))
+            continue;
+
+        vector<string> fields = split_list(line);
+        if (fields.size() < 3 or fields.size() > 4)
+            return "expected rt_width,mz_width,iratio[,confidence] on line " + to_string(line_num) + " of " + sweep_file;
+
+        ScoreParams params;
+        params.rt_width = atof(fields[0].c_str());
+        params.mz_width = atof(fields[1].c_str());
+        params.intensity_ratio = atof(fields[2].c_str());
+        params.confidence = fields.size() > 3 ? atof(fields[3].c_str()) : 0.0;
+        if (params.rt_width <= 0 or params.mz_width <= 0 or params.intensity_ratio <= 0 or params.confidence < 0)
+            return "invalid parameters on line " + to_string(line_num) + " of " + sweep_file;
+        param_sets.push_back(params);
+    }
+
+    if (param_sets.empty())
+        return "no parameter sets in " + sweep_file;
+    return "";
+}
+
+/*! Read a list of targets to score.
+ *
+ * Each line of the file gives one target as comma separated M/Z, optional
+ * PPM tolerance and optional RT start and end in seconds, e.g.
+ * "478.2231,5,600,900". Blank lines and lines starting with '#' or a
+ * column header are skipped.
+ *
+ * @param targets_file Path to the targets file.
+ * @param targets Filled with one entry per line.
+ *
+ * @return Empty string on success, otherwise a description of the problem.
+ */
+static string read_targets_file(const string &targets_file, vector<Target> &targets)
+{
+    ifstream targets_fs(targets_file);
+    if (!targets_fs)
+        return "cannot open targets file " + targets_file;
+
+    string line;
+    int line_num = 0;
+    while (getline(targets_fs, line))
+    {
+        line_num++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == string::npos or line[first] == '#' or isalpha(line[first]))
+            continue;
+
+        vector<string> fields = split_list(line);
+        if (fields.size() != 1 and fields.size() != 2 and fields.size() != 4)
+            return "expected mz[,ppm[,rt_start,rt_end]] on line " + to_string(line_num) + " of " + targets_file;
+
+        Target target;
+        target.mz = atof(fields[0].c_str());
+        target.ppm = fields.size() > 1 ? atof(fields[1].c_str()) : default_target_ppm;
+        target.rt_start = -numeric_limits<double>::max();
+        target.rt_end = numeric_limits<double>::max();
+        if (fields.size() > 2)
+        {
+            target.rt_start = atof(fields[2].c_str());
+            target.rt_end = atof(fields[3].c_str());
+        }
+        if (target.mz <= 0 or target.ppm <= 0 or target.rt_end < target.rt_start)
+            return "invalid target on line " + to_string(line_num) + " of " + targets_file;
+        targets.push_back(target);
+    }
+
+    if (targets.empty())
+        return "no targets in " + targets_file;
+    return "";
+}
+
+/*! Options with every default, for scoring through the library. Set the
+ * fields, then call build_models().
+ */
+Options::Options()
+{
+    set_defaults();
+}
+
+//! @brief Set every option to its default.
+void Options::set_defaults(void)
 {
     list_max = false;
+    discover = false;
+    discover_min_delta = default_discover_min_delta;
+    discover_max_delta = default_discover_max_delta;
+    discover_bin_width = default_discover_bin_width;
+    discover_peaks = default_discover_peaks;
+    discover_top = default_discover_top;
     intensity_ratio = default_intensity_ratio;
+    rt_width = default_rt_width;
+    mz_width = default_fwhm;
     confidence = 0;
     in_file = "";
     out_file = "";
     debug = false;
     num_threads = 1;
+    spectrum_start = 0;
+    spectrum_end = numeric_limits<int>::max();
+    rt_start = -numeric_limits<double>::max();
+    rt_end = numeric_limits<double>::max();
+    mz_start = 0.0;
+    mz_end = numeric_limits<double>::max();
+    ms_level = 0;
+    polarity = 0;
+    scan_filter = "";
+    centroid = false;
+    strip_zeros = false;
+    noise_mad = 0.0;
+    keep_boundary_zeros = false;
+    screen_threshold = 0.0;
+    screen_report = false;
+    verify = 0.0;
     input_spectrum_cache_size = default_input_spectrum_cache_size;
+    checkpoint_interval = 0;
+    resume = false;
+    live = false;
+    batch_file = "";
+    batch_open_files = default_batch_open_files;
+    serve_socket = "";
+    serve_cache_size = default_serve_cache_size;
+    serve_files = default_serve_files;
+    profile = false;
+    profile_json = "";
+    trace_file = "";
+    trace_spans = default_trace_spans;
+    perf = false;
+    progress = false;
+    progress_interval = default_progress_interval;
+    status_file = "";
+    charges = {1};
+}
+
+/*! Build the ion models to score from mz_deltas, multiplets and charges,
+ * and a single parameter set from the scoring options unless param_sets is
+ * already filled, e.g. by a parameter sweep.
+ */
+void Options::build_models(void)
+{
+    models.clear();
+
+    // Every delta and multiplet is scored at every charge state
+    for (auto mz_delta : mz_deltas)
+    {
+        for (auto charge : charges)
+        {
+            IonModel model;
+            model.offsets.push_back(mz_delta / charge);
+            model.ratios.push_back(1.0);
+            model.label = "_d" + format_number(mz_delta) + "_z" + to_string(charge);
+            models.push_back(model);
+        }
+    }
+    for (size_t multiplet_idx = 0; multiplet_idx < multiplets.size(); ++multiplet_idx)
+    {
+        IonModel multiplet;
+        if (!parse_multiplet(multiplets[multiplet_idx], multiplet))
+        {
+            throw runtime_error(string("multiplet offsets and ratios must be greater than zero: ") + multiplets[multiplet_idx]);
+        }
+        for (auto charge : charges)
+        {
+            IonModel model(multiplet);
+            for (auto &offset : model.offsets)
+                offset /= charge;
+            model.label = "_m" + to_string(multiplet_idx + 1) + "_z" + to_string(charge);
+            models.push_back(model);
+        }
+    }
+    if (param_sets.empty())
+    {
+        ScoreParams params;
+        params.rt_width = rt_width;
+        params.mz_width = mz_width;
+        params.intensity_ratio = intensity_ratio;
+        params.confidence = confidence;
+        param_sets.push_back(params);
+    }
+}
+
+Options::Options(int argc, char* argv[])
+{
+    set_defaults();
     int num_args;
 
     string list_max_str = "Flag, only output list of local maximum in window defined by M/Z width and retention time width. Default: not set";
-    string iratio_str = "Ratio of doublet intensities (isotope / parent). Defaults to " + to_string(default_intensity_ratio);
+    string discover_str = "Flag, report candidate M/Z deltas from a histogram of M/Z differences between co-occurring peaks instead of scoring. Default: not set";
+    string discover_range_str = "Range of M/Z deltas considered by '--discover', as min:max. Defaults to " + format_number(default_discover_min_delta) + ":" + format_number(default_discover_max_delta);
+    string discover_bin_str = "Histogram bin width in M/Z for '--discover'. Defaults to " + format_number(default_discover_bin_width);
+    string discover_peaks_str = "Number of most intense peaks of each spectrum paired by '--discover', with those of every spectrum in its RT window. Defaults to " + to_string(default_discover_peaks);
+    string discover_top_str = "Number of candidate deltas reported by '--discover'. Defaults to " + to_string(default_discover_top);
+    string iratio_str = "Ratio of doublet intensities (isotope / parent), for multiplets this scales the ratio of every member. Defaults to " + to_string(default_intensity_ratio);
+    string sweep_str = "Score every parameter set in a grid file (lines of rt_width,mz_width,iratio[,confidence]) in one pass, each to its own output, with a summary table";
     string rtwidth_str = "REQUIRED: Full width at half maximum for retention time in number of scans. Eg: 17";
     string mzwidth_str = "REQUIRED: M/Z full width at half maximum in parts per million. Eg: 150. If '--listmax', then upper and lower M/Z offset, e.g. 0.25";
-    string mzdelta_str = "REQUIRED: M/Z delta for doublets. Eg: " + to_string(default_mz_delta);
+    string mzdelta_str = "REQUIRED: M/Z delta for doublets. Eg: " + to_string(default_mz_delta) + ". A comma separated list (or repeated option) scores every delta in one pass";
+    string charges_str = "Comma separated list of charge states. Each M/Z delta and multiplet offset is divided by each charge. Defaults to 1";
+    string multiplet_str = "Score a multiplet of three or more ions, given as comma separated offset:ratio pairs for each ion heavier than the natural ion. Eg: 6.0201:1,12.0402:0.5";
     string confidence_str = "Lower confidence interval to apply during scoring (In standard deviations, e.g. 1.96 for a 95% CI). Default: ignore confidence intervals";
+    string targets_str = "Only score points matching a target in this file. One target per line as mz[,ppm[,rt_start,rt_end]] with RT in seconds. Default tolerance " + format_number(default_target_ppm) + " ppm";
+    string spectrum_range_str = "Only score the selected spectra from start up to (not including) end, counting from zero, as start:end. The window either side is read but not scored, so the outputs of consecutive ranges can be joined with hitime-merge. Default: all spectra";
+    string rt_range_str = "Only score spectra in this retention time range, in seconds, as start:end. Spectra outside it (and the window either side) are never read. Default: all spectra";
+    string mz_range_str = "Only score points in this M/Z range, as start:end. Points outside it (and the isotope ion regions) are removed as spectra are read. Default: all points";
+    string ms_level_str = "Only score spectra of this MS level, e.g. 1. Windows are built over the selected spectra only. Default: all spectra";
+    string polarity_str = "Only score spectra of this polarity, '+' or '-'. Default: all spectra";
+    string scan_filter_str = "Only score spectra whose scan filter string contains this text. Default: all spectra";
+    string centroid_str = "Flag, centroid profile spectra as they are read and score the centroids only. Default: not set";
+    string strip_zeros_str = "Flag, remove zero intensity points from each spectrum as it is read. Default: not set";
+    string noise_mad_str = "Remove points at or below this many median absolute deviations above the median intensity of each spectrum as it is read, e.g. 3. Implies '--strip-zeros'. Default: keep all points";
+    string keep_boundary_zeros_str = "Flag, keep removed points next to a kept point, so peaks keep their edges. Default: not set";
+    string screen_str = "Only fully score points whose intensity in the centre spectrum agrees with the expected isotope ion intensities to at least this fraction (0 to 1], e.g. 0.2. Default: score all points";
+    string verify_str = "Score this fraction (0 to 1] of the centre points again with the plain reference scoring, without the shortcuts of the scoring path or the screen, and report the largest and percentile score deviations and any zero/nonzero disagreements, e.g. 0.001. The points are sampled the same way on every run. Default: not set";
+    string screen_report_str = "Fully score points rejected by '--screen' too, and report how many nonzero scores the screen drops";
+    string checkpoint_str = "Write the output in parts, closing a part and recording progress in a checkpoint file after every this many spectra, e.g. 1000. The parts are joined at the end. Default: no checkpoints";
+    string resume_str = "Flag, continue an interrupted '--checkpoint' run from its last checkpoint, or start it if there is none. Default: not set";
+    string live_str = "Flag, read the input as a stream of mzML, e.g. a pipe or '-' for standard input, scoring each spectrum once the window after it has arrived. Default: not set";
+    string batch_str = "Score every job in this manifest (lines of input,output) in one run, sharing the worker threads between files. Replaces '-i' and '-o'";
+    string batch_open_str = "Number of '--batch' input files open at once, which bounds memory use. Defaults to " + to_string(default_batch_open_files);
+    string serve_str = "Run as a server, taking scoring jobs (hitime-score arguments, one job per connection) on this Unix domain socket. Loaded files and decoded spectra are kept for later jobs";
+    string serve_cache_str = "Number of decoded spectra the server keeps for each input file. Defaults to " + to_string(default_serve_cache_size);
+    string serve_files_str = "Number of input files the server keeps loaded. Defaults to " + to_string(default_serve_files);
+    string profile_str = "Flag, time each stage of scoring (index load, decoding, windows, scoring, lock waits, writing) and count cache and output queue events, printing a summary at the end. Default: not set";
+    string profile_json_str = "Also write the '--profile' summary, with each thread's timers and counters, to this JSON file. Implies '--profile'";
+    string trace_str = "Record each thread's activity (fetching, decoding, windows, scoring, output, lock waits) and write it to this file as Chrome trace JSON, e.g. for Perfetto";
+    string trace_spans_str = "Number of latest spans '--trace' keeps for each thread. Each span takes 24 bytes, so each thread and the main thread use up to 24 times this many bytes. Defaults to " + to_string(default_trace_spans);
+    string perf_str = "Flag, count cycles, instructions, cache and branch misses with the Linux perf_event_open counters while scoring, windowing and fetching spectra, adding IPC and miss rates to the '--profile' summary. Implies '--profile'. Default: not set";
+    string progress_str = "Flag, report the spectra and points scored per second, percent complete, input cache hit rate and estimated time left on stderr while scoring. Default: not set";
+    string progress_interval_str = "Seconds between '--progress' reports and '--status-file' updates. Defaults to " + to_string(int(default_progress_interval));
+    string status_file_str = "Rewrite this file with the '--progress' figures as JSON every interval, e.g. for a job scheduler. Batch jobs append their job number to the name";
     string threads_str = "Number of threads to use. Defaults to "  + to_string(num_threads);
     string desc = "Detect twin ion signal in Mass Spectrometry data";
     string input_spectrum_cache_size_str = "Number of input spectra to retain in cache. Defaults to " + to_string(default_input_spectrum_cache_size);
@@ -35,13 +389,51 @@ Options::Options(int argc, char* argv[])
         options.add_options()
             ("h,help", "Show this help information.")
             ("l,listmax", list_max_str, cxxopts::value<bool>())
+            ("discover", discover_str)
+            ("discover-range", discover_range_str, cxxopts::value<string>())
+            ("discover-bin", discover_bin_str, cxxopts::value<double>())
+            ("discover-peaks", discover_peaks_str, cxxopts::value<int>())
+            ("discover-top", discover_top_str, cxxopts::value<int>())
             ("a,iratio", iratio_str, cxxopts::value<double>())
             ("r,rtwidth", rtwidth_str, cxxopts::value<double>())
             ("m,mzwidth", mzwidth_str, cxxopts::value<double>())
-            ("d,mzdelta", mzdelta_str, cxxopts::value<double>())
+            ("d,mzdelta", mzdelta_str, cxxopts::value<vector<string>>())
+            ("charges", charges_str, cxxopts::value<string>())
+            ("multiplet", multiplet_str, cxxopts::value<vector<string>>())
             ("z,confidence", confidence_str, cxxopts::value<double>())
+            ("sweep", sweep_str, cxxopts::value<string>())
+            ("targets", targets_str, cxxopts::value<string>())
+            ("spectrum-range", spectrum_range_str, cxxopts::value<string>())
+            ("rt-range", rt_range_str, cxxopts::value<string>())
+            ("mz-range", mz_range_str, cxxopts::value<string>())
+            ("ms-level", ms_level_str, cxxopts::value<int>())
+            ("polarity", polarity_str, cxxopts::value<string>())
+            ("scan-filter", scan_filter_str, cxxopts::value<string>())
+            ("centroid", centroid_str)
+            ("strip-zeros", strip_zeros_str)
+            ("noise-mad", noise_mad_str, cxxopts::value<double>())
+            ("keep-boundary-zeros", keep_boundary_zeros_str)
+            ("screen", screen_str, cxxopts::value<double>())
+            ("screen-report", screen_report_str)
+            ("verify", verify_str, cxxopts::value<double>())
             ("debug", "Generate debugging output")
+            ("profile", profile_str)
+            ("profile-json", profile_json_str, cxxopts::value<string>())
+            ("trace", trace_str, cxxopts::value<string>())
+            ("trace-spans", trace_spans_str, cxxopts::value<int>())
+            ("perf", perf_str)
+            ("progress", progress_str)
+            ("progress-interval", progress_interval_str, cxxopts::value<double>())
+            ("status-file", status_file_str, cxxopts::value<string>())
             ("version", "Print version number and exit")
+            ("checkpoint", checkpoint_str, cxxopts::value<int>())
+            ("resume", resume_str)
+            ("live", live_str)
+            ("batch", batch_str, cxxopts::value<string>())
+            ("batch-open", batch_open_str, cxxopts::value<int>())
+            ("serve", serve_str, cxxopts::value<string>())
+            ("serve-cache", serve_cache_str, cxxopts::value<int>())
+            ("serve-files", serve_files_str, cxxopts::value<int>())
             ("j,threads", threads_str, cxxopts::value<int>())
             ("c,cache", input_spectrum_cache_size_str , cxxopts::value<int>())
             ("i,infile", "Input mzML file", cxxopts::value<string>())
@@ -52,19 +444,47 @@ Options::Options(int argc, char* argv[])
 
         if (num_args <= 1)
         {
-            cout << program_name << " insufficient command line arguments." << endl;
-            cout << options.help() << endl;
-            exit(0);
+            throw OptionsExit(program_name + " insufficient command line arguments.\n" + options.help(), 0);
         }
 
         if (result.count("help")) {
-            cout << options.help() << endl;
-            exit(0);
+            throw OptionsExit(options.help(), 0);
         }
 
         if (result.count("listmax")) {
             list_max = result["listmax"].as<bool>();
         }
+        if (result.count("discover")) {
+            discover = true;
+        }
+        if (result.count("discover-range")) {
+            if (!parse_range(result["discover-range"].as<string>(), discover_min_delta, discover_max_delta)
+                or discover_min_delta <= 0)
+            {
+                throw runtime_error("discovery range must be given as min:max, positive with min less than max");
+            }
+        }
+        if (result.count("discover-bin")) {
+            discover_bin_width = result["discover-bin"].as<double>();
+            if (discover_bin_width <= 0)
+            {
+                throw runtime_error("discovery bin width must be greater than zero");
+            }
+        }
+        if (result.count("discover-peaks")) {
+            discover_peaks = result["discover-peaks"].as<int>();
+            if (discover_peaks < 2)
+            {
+                throw runtime_error("discovery needs at least two peaks per spectrum");
+            }
+        }
+        if (result.count("discover-top")) {
+            discover_top = result["discover-top"].as<int>();
+            if (discover_top < 1)
+            {
+                throw runtime_error("discovery must report at least one candidate");
+            }
+        }
         if (result.count("iratio")) {
             intensity_ratio = result["iratio"].as<double>();
         }
@@ -72,11 +492,10 @@ Options::Options(int argc, char* argv[])
             rt_width = result["rtwidth"].as<double>();
             if (rt_width <= 0)
             {
-                cerr << program_name << " ERROR: Retention time full width at half maximum must be greater than zero";
-                exit(-1);
+                throw runtime_error("Retention time full width at half maximum must be greater than zero");
             }
         }
-        else
+        else if (!discover and !result.count("sweep"))
         {
             msgs += "MISSING: Retention time full width at half maximum must be given.\n";
         }
@@ -84,33 +503,56 @@ Options::Options(int argc, char* argv[])
             mz_width = result["mzwidth"].as<double>();
             if (mz_width <= 0)
             {
-                cerr << program_name << " ERROR: m/z full width at half maximum must be greater than zero";
-                exit(-1);
+                throw runtime_error("m/z full width at half maximum must be greater than zero");
             }
         }
-        else
+        else if (!discover and !result.count("sweep"))
         {
             msgs += "MISSING: m/z full width at half maximum must be given.\n";
         }
         if (result.count("mzdelta")) {
-            mz_delta = result["mzdelta"].as<double>();
-            if (mz_delta <= 0)
+            for (auto &delta_list : result["mzdelta"].as<vector<string>>())
             {
-                cerr << program_name << " ERROR: m/z twin ion mass difference must be greater than zero";
-                exit(-1);
+                for (auto &delta_str : split_list(delta_list))
+                {
+                    double mz_delta = atof(delta_str.c_str());
+                    if (mz_delta <= 0)
+                    {
+                        throw runtime_error("m/z twin ion mass difference must be greater than zero");
+                    }
+                    mz_deltas.push_back(mz_delta);
+                }
             }
         }
+        if (result.count("multiplet")) {
+            multiplets = result["multiplet"].as<vector<string>>();
+        }
         // Need M/Z mass difference unless listing local maxima
-        else if (result.count("listmax") == false)
+        if (mz_deltas.empty() and multiplets.empty() and result.count("listmax") == false and !discover)
         {
             msgs += "MISSING: m/z twin ion mass difference must be given.\n";
         }
+        if (result.count("charges")) {
+            charges.clear();
+            for (auto &charge_str : split_list(result["charges"].as<string>()))
+            {
+                int charge = atoi(charge_str.c_str());
+                if (charge < 1)
+                {
+                    throw runtime_error("charge states must be greater than zero");
+                }
+                charges.push_back(charge);
+            }
+            if (charges.empty())
+            {
+                throw runtime_error("at least one charge state must be given");
+            }
+        }
         if (result.count("confidence")) {
             confidence = result["confidence"].as<double>();
             if (confidence <= 0)
             {
-                cerr << program_name << " ERROR: confidance must be greater than zero";
-                exit(-1);
+                throw runtime_error("confidance must be greater than zero");
             }
         }
         if (result.count("infile")) {
@@ -119,19 +561,124 @@ Options::Options(int argc, char* argv[])
         if (result.count("outfile")) {
             out_file = result["outfile"].as<string>();
         }
+        if (result.count("checkpoint")) {
+            checkpoint_interval = result["checkpoint"].as<int>();
+            if (checkpoint_interval < 1)
+            {
+                throw runtime_error("checkpoint interval must be at least one spectrum");
+            }
+            if (discover or result.count("live"))
+            {
+                throw runtime_error("checkpoints cannot be combined with '--discover' or '--live'");
+            }
+        }
+        if (result.count("resume")) {
+            if (!result.count("checkpoint"))
+            {
+                throw runtime_error("'--resume' needs the '--checkpoint' interval of the run");
+            }
+            resume = true;
+        }
+        if (result.count("live")) {
+            if (discover or result.count("batch") or result.count("serve"))
+            {
+                throw runtime_error("live input cannot be combined with '--discover', '--batch' or '--serve'");
+            }
+            if (result.count("spectrum-range") or result.count("rt-range"))
+            {
+                throw runtime_error("live input cannot be combined with '--spectrum-range' or '--rt-range'");
+            }
+            live = true;
+        }
+        if (result.count("batch")) {
+            if (discover)
+            {
+                throw runtime_error("a batch cannot be combined with '--discover'");
+            }
+            if (in_file != "" or out_file != "")
+            {
+                throw runtime_error("a batch takes its input and output files from the manifest, not '-i' and '-o'");
+            }
+            batch_file = result["batch"].as<string>();
+            string batch_error = read_batch_file(batch_file, batch_jobs);
+            if (batch_error != "")
+            {
+                throw runtime_error(batch_error);
+            }
+        }
+        if (result.count("batch-open")) {
+            batch_open_files = result["batch-open"].as<int>();
+            if (batch_open_files < 1)
+            {
+                throw runtime_error("number of open batch files may not be less than 1");
+            }
+        }
+        if (result.count("serve")) {
+            if (result.count("batch"))
+            {
+                throw runtime_error("a server cannot be combined with '--batch'");
+            }
+            serve_socket = result["serve"].as<string>();
+        }
+        if (result.count("serve-cache")) {
+            serve_cache_size = result["serve-cache"].as<int>();
+            if (serve_cache_size < 0)
+            {
+                throw runtime_error("server cache size may not be negative");
+            }
+        }
+        if (result.count("serve-files")) {
+            serve_files = result["serve-files"].as<int>();
+            if (serve_files < 1)
+            {
+                throw runtime_error("number of server files may not be less than 1");
+            }
+        }
         if (result.count("debug")) {
             debug = true;
         }
+        if (result.count("profile")) {
+            profile = true;
+        }
+        if (result.count("profile-json")) {
+            profile = true;
+            profile_json = result["profile-json"].as<string>();
+        }
+        if (result.count("trace")) {
+            trace_file = result["trace"].as<string>();
+        }
+        if (result.count("trace-spans")) {
+            trace_spans = result["trace-spans"].as<int>();
+            if (trace_spans < 1)
+            {
+                throw runtime_error("number of trace spans may not be less than 1");
+            }
+        }
+        if (result.count("perf")) {
+            profile = true;
+            perf = true;
+        }
+        if (result.count("progress")) {
+            progress = true;
+        }
+        if (result.count("progress-interval")) {
+            progress_interval = result["progress-interval"].as<double>();
+            if (progress_interval <= 0.0)
+            {
+                throw runtime_error("progress interval must be greater than 0");
+            }
+        }
+        if (result.count("status-file")) {
+            status_file = result["status-file"].as<string>();
+        }
         if (result.count("version")) {
-            cout << program_name << " version " << HITIME_VERSION << endl; 
-            exit(0);
+            throw OptionsExit(program_name + " version " + HITIME_VERSION, 0);
         }
         if (result.count("threads")) {
             int requested_threads = result["threads"].as<int>();
             if (requested_threads < 1)
             {
-                cerr << program_name << " ERROR: number of requested threads may not be less than 1";
-                exit(-1);
+                throw runtime_error("number of requested threads may not be less than 1");
             }
             num_threads = requested_threads;
         }
@@ -139,22 +686,128 @@ Options::Options(int argc, char* argv[])
             int requested_size = result["cache"].as<int>();
             if (requested_size < 0)
             {
-                cerr << program_name << " ERROR: requested cache size must be non-negative";
-                exit(-1);
+                throw runtime_error("requested cache size must be non-negative");
             }
             input_spectrum_cache_size = requested_size;
         }
-        if (msgs != "") {
-            cout << program_name << endl;
-            cout << msgs << endl;
-            cout << options.help() << endl;
-            exit(-1);
+        if (result.count("spectrum-range")) {
+            double start, end;
+            if (!parse_range(result["spectrum-range"].as<string>(), start, end)
+                or start < 0 or start != floor(start) or end != floor(end))
+            {
+                throw runtime_error("spectrum range must be given as start:end, whole numbers with 0 <= start < end");
+            }
+            spectrum_start = start;
+            spectrum_end = min(end, double(numeric_limits<int>::max()));
+        }
+        if (result.count("rt-range")) {
+            if (!parse_range(result["rt-range"].as<string>(), rt_start, rt_end))
+            {
+                throw runtime_error("retention time range must be given as start:end with start less than end");
+            }
+        }
+        if (result.count("mz-range")) {
+            if (!parse_range(result["mz-range"].as<string>(), mz_start, mz_end) or mz_start < 0)
+            {
+                throw runtime_error("m/z range must be given as start:end with 0 <= start < end");
+            }
+        }
+        if (result.count("ms-level")) {
+            ms_level = result["ms-level"].as<int>();
+            if (ms_level < 1)
+            {
+                throw runtime_error("MS level must be greater than zero");
+            }
+        }
+        if (result.count("polarity")) {
+            string polarity_str = result["polarity"].as<string>();
+            if (polarity_str == "+" or polarity_str == "positive")
+                polarity = 1;
+            else if (polarity_str == "-" or polarity_str == "negative")
+                polarity = -1;
+            else
+            {
+                throw runtime_error("polarity must be '+' or '-'");
+            }
+        }
+        if (result.count("scan-filter")) {
+            scan_filter = result["scan-filter"].as<string>();
+        }
+        if (result.count("centroid")) {
+            centroid = true;
+        }
+        if (result.count("strip-zeros")) {
+            strip_zeros = true;
+        }
+        if (result.count("noise-mad")) {
+            noise_mad = result["noise-mad"].as<double>();
+            if (noise_mad <= 0)
+            {
+                throw runtime_error("noise level must be greater than zero median absolute deviations");
+            }
+            strip_zeros = true;
+        }
+        if (result.count("keep-boundary-zeros")) {
+            keep_boundary_zeros = true;
+        }
+        if (result.count("screen")) {
+            screen_threshold = result["screen"].as<double>();
+            if (screen_threshold <= 0 or screen_threshold > 1)
+            {
+                throw runtime_error("screen threshold must be greater than zero and at most one");
+            }
+        }
+        if (result.count("screen-report")) {
+            if (screen_threshold == 0)
+            {
+                throw runtime_error("'--screen-report' needs a '--screen' threshold");
+            }
+            screen_report = true;
+        }
+        if (result.count("verify")) {
+            if (list_max or discover)
+            {
+                throw runtime_error("'--verify' checks scoring, it cannot be combined with '--listmax' or '--discover'");
+            }
+            verify = result["verify"].as<double>();
+            if (verify <= 0 or verify > 1)
+            {
+                throw runtime_error("verify fraction must be greater than zero and at most one");
+            }
+        }
+        if (result.count("targets")) {
+            if (list_max or discover)
+            {
+                throw runtime_error("targets cannot be combined with '--listmax' or '--discover'");
+            }
+            targets_file = result["targets"].as<string>();
+            string targets_error = read_targets_file(targets_file, targets);
+            if (targets_error != "")
+            {
+                throw runtime_error(targets_error);
+            }
+        }
+        if (result.count("sweep")) {
+            if (list_max or discover)
+            {
+                throw runtime_error("a parameter sweep cannot be combined with '--listmax' or '--discover'");
+            }
+            sweep_file = result["sweep"].as<string>();
+            string sweep_error = read_sweep_file(sweep_file, param_sets);
+            if (sweep_error != "")
+            {
+                throw runtime_error(sweep_error);
+            }
+        }
+        build_models();
+        // a server takes the scoring options of each job from its client
+        if (msgs != "" and serve_socket == "") {
+            throw OptionsExit(program_name + "\n" + msgs + "\n" + options.help(), -1);
         }
     }
 
     catch (const cxxopts::OptionException& e)
     {
-        std::cout << "error parsing options: " << e.what() << std::endl;
-        exit(1);
+        throw OptionsError(string("error parsing options: ") + e.what());
     }
 }
@@ -2,7 +2,68 @@
 #define HITIME_OPTIONS_H
 
 #include <unistd.h>
+#include <stdexcept>
 #include <string>
+#include <vector>
+
+/*! An ion model to score against the data.
+ *
+ * The natural ion is always the first member of a model, at zero offset and
+ * unit intensity. Each further member is given by its M/Z offset from the
+ * natural ion and its intensity ratio relative to it. A twin-ion model has
+ * one further member.
+ */
+struct IonModel {
+    std::vector<double> offsets; //!< M/Z offset of each heavier member.
+    std::vector<double> ratios; //!< Intensity ratio (member / natural) of each heavier member.
+    std::string label; //!< Output file name suffix when scoring several models.
+};
+
+/*! One set of scoring parameters.
+ *
+ * Normally there is a single set, taken from the command line. A parameter
+ * sweep scores several sets against the same input in one pass.
+ */
+struct ScoreParams {
+    double rt_width; //!< Retention time FWHM in scans.
+    double mz_width; //!< MZ FWHM in PPM.
+    double intensity_ratio; //!< Intensity ratio between lo and hi peaks.
+    double confidence; //!< Confidence for keeping score.  In Standard Deviations.
+
+    // Derived from the above by the Scorer
+    int half_window; //!< Number of spectra each side of the centre in the window.
+    double min_sample; //!< Minimum number of points required in each region.
+    std::vector<double> rt_shape; //!< Gaussian shape in the RT direction.
+};
+
+/*! An M/Z, with optional RT range, to score.
+ *
+ * When targets are given only the points matching a target are scored.
+ */
+struct Target {
+    double mz; //!< Target M/Z.
+    double ppm; //!< M/Z tolerance in PPM.
+    double rt_start; //!< Start of the RT range in seconds.
+    double rt_end; //!< End of the RT range in seconds.
+};
+
+/*! A command line that does not parse. Other errors in the options are
+ * thrown as std::runtime_error.
+ */
+class OptionsError : public std::runtime_error {
+    public:
+        explicit OptionsError(const std::string &message) : std::runtime_error(message) {}
+};
+
+/*! A command line that ends with usage text instead of scoring, e.g.
+ * '--help', '--version', or missing required options. what() is the text
+ * to print to stdout and status the exit status.
+ */
+class OptionsExit : public std::runtime_error {
+    public:
+        OptionsExit(const std::string &message, int status) : std::runtime_error(message), status(status) {}
+        int status;
+};
 
 class Options {
 
@@ -10,21 +71,72 @@ class Options {
         bool debug;
         bool version;
         double list_max; //!< Flag, if set list local maxima only.
+        bool discover; //!< Flag, if set report candidate M/Z deltas instead of scoring.
+        double discover_min_delta; //!< Smallest M/Z delta considered by discovery.
+        double discover_max_delta; //!< Largest M/Z delta considered by discovery.
+        double discover_bin_width; //!< Discovery histogram bin width in M/Z.
+        int discover_peaks; //!< Number of most intense peaks per spectrum paired by discovery.
+        int discover_top; //!< Number of candidate deltas reported by discovery.
         double intensity_ratio; //!< Intensity ratio between lo and hi peaks.
         double rt_width; //!< Retention time FWHM in scans.
         double rt_sigma; //!< Boundary for RT width in SDs.
         double ppm; //!< MZ tolerance in PPM.
         double mz_width; //!< MZ FWHM in PPM.
         double mz_sigma; //!< Boundary for MZ in SDs.
-        double mz_delta; //!< MZ difference between peaks.
+        std::vector<double> mz_deltas; //!< MZ differences between peaks, one scoring pass each.
+        std::vector<int> charges; //!< Charge states, each delta is divided by each charge.
+        std::vector<std::string> multiplets; //!< Multiplet models as "offset:ratio,..." lists.
+        std::string sweep_file; //!< Path to parameter grid file for a parameter sweep.
+        std::vector<ScoreParams> param_sets; //!< Every parameter set to score.
+        std::string targets_file; //!< Path to a list of target M/Z values to score.
+        std::vector<Target> targets; //!< Targets to score, all points if empty.
+        std::vector<IonModel> models; //!< Every model to score, built from deltas, multiplets and charges.
         double min_sample; //!< Minimum number of points required in each region.
         double confidence; //!< Confidence for keeping score.  In Standard Deviations.
+        int spectrum_start; //!< First spectrum to score, counting selected spectra from zero.
+        int spectrum_end; //!< One past the last spectrum to score.
+        double rt_start; //!< Start of the retention time range to score, in seconds.
+        double rt_end; //!< End of the retention time range to score, in seconds.
+        double mz_start; //!< Start of the M/Z range to score.
+        double mz_end; //!< End of the M/Z range to score.
+        int ms_level; //!< Only score spectra of this MS level, zero for all.
+        int polarity; //!< Only score spectra of this polarity, 1 positive, -1 negative, zero for all.
+        std::string scan_filter; //!< Only score spectra whose filter string contains this text.
+        bool centroid; //!< Flag, if set centroid profile spectra as they are read.
+        bool strip_zeros; //!< Flag, if set remove zero intensity points as spectra are read.
+        double noise_mad; //!< Remove points below this many MADs above the median intensity, zero to keep them.
+        bool keep_boundary_zeros; //!< Flag, if set keep removed points next to signal.
+        double screen_threshold; //!< Centre row agreement needed to fully score a point, zero to score all.
+        bool screen_report; //!< Flag, if set measure how many nonzero scores the screen drops.
+        double verify; //!< Fraction of centre points to score again with the reference scoring, zero for none.
+        int checkpoint_interval; //!< Spectra written between checkpoints, zero for none.
+        bool resume; //!< Flag, if set resume from the last checkpoint.
+        bool live; //!< Flag, if set read the input as a stream, scoring spectra as they arrive.
+        std::string batch_file; //!< Path to a manifest of input and output files to score in one run.
+        std::vector<std::pair<std::string, std::string>> batch_jobs; //!< Input and output file of each batch job.
+        int batch_open_files; //!< Number of batch input files open at once.
+        std::string serve_socket; //!< Path of a Unix domain socket to serve scoring jobs on.
+        int serve_cache_size; //!< Number of decoded spectra a server keeps for each input file.
+        int serve_files; //!< Number of input files a server keeps loaded.
+        bool profile; //!< Flag, if set time each stage of scoring and report at the end.
+        std::string profile_json; //!< Path to write the profile to as JSON, empty for none.
+        std::string trace_file; //!< Path to write a Chrome trace of each thread's activity to, empty for none.
+        int trace_spans; //!< Number of latest spans the trace keeps for each thread.
+        bool perf; //!< Flag, if set count hardware events in the profiled stages.
+        bool progress; //!< Flag, if set report progress on stderr while scoring.
+        double progress_interval; //!< Seconds between progress reports.
+        std::string status_file; //!< Path to rewrite with the progress as JSON, empty for none.
         int num_threads;
         int input_spectrum_cache_size; //!< Size of input spectrum cache in number of spectra. 
         std::string in_file; //!< Path to input file.
         std::string out_file; //!< Path to output file.
 
+        Options();
         Options(int argc, char *argv[]);
+        void build_models(void);
+
+    private:
+        void set_defaults(void);
 };
 
 #endif
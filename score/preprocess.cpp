@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "constants.h"
+#include "preprocess.h"
+
+using namespace OpenMS;
+using namespace std;
+
+/*! Estimate the noise level of a spectrum as a number of (normal consistent)
+ * median absolute deviations above the median of its nonzero intensities.
+ *
+ * @param spectrum The spectrum.
+ * @param noise_mad Number of median absolute deviations above the median.
+ *
+ * @return The noise level, zero if the spectrum has no nonzero points.
+ */
+double noise_level(const PeakSpectrum &spectrum, double noise_mad)
+{
+    vector<double> intensities;
+    for (auto it = spectrum.begin(); it != spectrum.end(); ++it)
+    {
+        if (it->getIntensity() > 0.0)
+            intensities.push_back(it->getIntensity());
+    }
+    if (intensities.empty())
+        return 0.0;
+
+    auto middle = intensities.begin() + intensities.size() / 2;
+    nth_element(intensities.begin(), middle, intensities.end());
+    double median = *middle;
+
+    for (auto &intensity : intensities)
+        intensity = fabs(intensity - median);
+    nth_element(intensities.begin(), middle, intensities.end());
+    double mad = *middle * mad_to_std_dev;
+
+    return median + noise_mad * mad;
+}
+
+/*! Remove points with zero intensity, or at or below the noise level, from
+ * a spectrum.
+ *
+ * Profile spectra contain long runs of zero (or near zero) intensity which
+ * would otherwise enter every window and be scored as centre points.
+ *
+ * @param spectrum The spectrum, sorted by M/Z, modified in place.
+ * @param noise_mad If greater than zero, also remove points at or below
+ * this many median absolute deviations above the median intensity.
+ * @param keep_boundary_zeros Keep removed points next to a kept point, so
+ * that peaks keep their edges.
+ */
+void strip_noise(PeakSpectrum &spectrum, double noise_mad, bool keep_boundary_zeros)
+{
+    double threshold = 0.0;
+    if (noise_mad > 0.0)
+        threshold = noise_level(spectrum, noise_mad);
+
+    Size elements = spectrum.size();
+    vector<bool> signal(elements);
+    for (Size index = 0; index < elements; ++index)
+    {
+        signal[index] = spectrum[index].getIntensity() > threshold;
+    }
+
+    Size kept = 0;
+    for (Size index = 0; index < elements; ++index)
+    {
+        bool boundary = keep_boundary_zeros and
+            ((index > 0 and signal[index - 1]) or (index + 1 < elements and signal[index + 1]));
+        if (signal[index] or boundary)
+        {
+            spectrum[kept++] = spectrum[index];
+        }
+    }
+    spectrum.resize(kept);
+}
+
+/*! Replace the points of a profile spectrum with the centroids of its peaks.
+ *
+ * A peak runs from one valley (a zero, a gap in M/Z or a rise after a
+ * fall) to the next. Its centroid M/Z is the intensity weighted mean M/Z
+ * of the points at or above half the apex intensity, and its intensity is
+ * the sum of the intensities of all of its points.
+ *
+ * @param spectrum Profile spectrum, sorted by M/Z, modified in place.
+ */
+void centroid_spectrum(PeakSpectrum &spectrum)
+{
+    Size elements = spectrum.size();
+    if (elements < 2)
+        return;
+
+    // Typical spacing between profile points, to find gaps between peaks
+    vector<double> spacing(elements - 1);
+    for (Size index = 0; index + 1 < elements; ++index)
+    {
+        spacing[index] = spectrum[index + 1].getMZ() - spectrum[index].getMZ();
+    }
+    auto middle = spacing.begin() + spacing.size() / 2;
+    nth_element(spacing.begin(), middle, spacing.end());
+    double max_gap = centroid_max_gap * *middle;
+
+    auto joined = [&spectrum, max_gap](Size index) {
+        return spectrum[index + 1].getIntensity() > 0.0 and
+               spectrum[index + 1].getMZ() - spectrum[index].getMZ() <= max_gap;
+    };
+
+    vector<Peak1D> centroids;
+    Size index = 0;
+    while (index < elements)
+    {
+        if (spectrum[index].getIntensity() <= 0.0)
+        {
+            index++;
+            continue;
+        }
+
+        // climb to the apex then descend to the next valley
+        Size start = index;
+        while (index + 1 < elements and joined(index) and
+               spectrum[index + 1].getIntensity() >= spectrum[index].getIntensity())
+            index++;
+        Size apex = index;
+        while (index + 1 < elements and joined(index) and
+               spectrum[index + 1].getIntensity() < spectrum[index].getIntensity())
+            index++;
+        Size end = index;
+
+        double half_max = 0.5 * spectrum[apex].getIntensity();
+        double weighted_mz = 0.0;
+        double weight = 0.0;
+        double area = 0.0;
+        for (Size point = start; point <= end; ++point)
+        {
+            double intensity = spectrum[point].getIntensity();
+            area += intensity;
+            if (intensity >= half_max)
+            {
+                weighted_mz += intensity * spectrum[point].getMZ();
+                weight += intensity;
+            }
+        }
+        centroids.push_back(Peak1D(weighted_mz / weight, area));
+
+        index = end + 1;
+    }
+
+    spectrum.clear(false);
+    for (auto &centroid : centroids)
+    {
+        spectrum.push_back(centroid);
+    }
+}
+
+/*! Remove the points of a spectrum outside an M/Z range.
+ *
+ * @param spectrum The spectrum, sorted by M/Z, modified in place.
+ * @param lower_mz Smallest M/Z to keep.
+ * @param upper_mz Largest M/Z to keep.
+ */
+void trim_mz_range(PeakSpectrum &spectrum, double lower_mz, double upper_mz)
+{
+    Size kept = 0;
+    for (Size index = 0; index < spectrum.size(); ++index)
+    {
+        double mz = spectrum[index].getMZ();
+        if (mz >= lower_mz and mz <= upper_mz)
+        {
+            spectrum[kept++] = spectrum[index];
+        }
+    }
+    spectrum.resize(kept);
+}
@@ -0,0 +1,20 @@
+#ifndef HITIME_PREPROCESS_H
+#define HITIME_PREPROCESS_H
+
+#include <OpenMS/KERNEL/MSSpectrum.h>
+
+using namespace OpenMS;
+
+//! @brief Remove zero and (optionally) noise intensity points from a spectrum.
+void strip_noise(PeakSpectrum &spectrum, double noise_mad, bool keep_boundary_zeros);
+
+//! @brief Median absolute deviation based noise level of a spectrum.
+double noise_level(const PeakSpectrum &spectrum, double noise_mad);
+
+//! @brief Replace the points of a profile spectrum with its peak centroids.
+void centroid_spectrum(PeakSpectrum &spectrum);
+
+//! @brief Remove the points of a spectrum outside an M/Z range.
+void trim_mz_range(PeakSpectrum &spectrum, double lower_mz, double upper_mz);
+
+#endif
@@ -0,0 +1,469 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "constants.h"
+#include "profile.h"
+
+using namespace std;
+
+thread_local int Profiler::thread_slot = 0;
+
+//! Name of each hardware event in JSON.
+static const char *perf_names[perf_events] = {
+    "cycles",
+    "instructions",
+    "cache_references",
+    "cache_misses",
+    "branches",
+    "branch_misses",
+};
+
+//! Events some thread could not count, by bit, reported as unavailable.
+static atomic<unsigned> perf_unavailable(0);
+//! Set once the hardware counters have been reported as not permitted.
+static atomic<bool> perf_warned(false);
+
+/*! The hardware counter group of one thread, opened on its first sample
+ * and closed when the thread exits. perf_event_open counts only the
+ * calling thread, so every thread needs its own group.
+ */
+struct PerfGroup
+{
+    bool tried; //!< Set once opening the group has been tried
+    int fds[perf_events]; //!< Counter of each event, -1 if not available; the first leads the group
+
+    PerfGroup() : tried(false) { fill(fds, fds + perf_events, -1); }
+    ~PerfGroup()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+            if (fd >= 0) close(fd);
+#endif
+    }
+
+    bool open_group(void);
+    bool read_group(PerfSample &sample);
+};
+
+static thread_local PerfGroup perf_group;
+
+/*! Open the counters of the calling thread, in user space only so that
+ * the default perf_event_paranoid setting permits them. Events the
+ * processor or a virtual machine does not count are left out.
+ *
+ * @return False if not even the cycle counter could be opened.
+ */
+bool PerfGroup::open_group(void)
+{
+    tried = true;
+#ifdef __linux__
+    static const uint64_t configs[perf_events] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    for (int event = 0; event < perf_events; ++event)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[event];
+        attr.disabled = event == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds[event] = syscall(__NR_perf_event_open, &attr, 0, -1, event == 0 ? -1 : fds[0], 0);
+        if (fds[event] < 0)
+        {
+            if (event == 0)
+            {
+                if (!perf_warned.exchange(true))
+                {
+                    cerr << program_name << " WARNING: hardware counters are not available (" << strerror(errno)
+                         << "), continuing without them. See /proc/sys/kernel/perf_event_paranoid" << endl;
+                }
+                return false;
+            }
+            perf_unavailable |= 1u << event;
+        }
+    }
+    ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    if (!perf_warned.exchange(true))
+        cerr << program_name << " WARNING: hardware counters are only supported on Linux, continuing without them" << endl;
+    return false;
+#endif
+}
+
+/*! Read every counter of the group at once.
+ *
+ * @return False if the group is not open or could not be read.
+ */
+bool PerfGroup::read_group(PerfSample &sample)
+{
+    if (!tried)
+        open_group();
+    if (fds[0] < 0)
+        return false;
+#ifdef __linux__
+    // number of events, time enabled, time running, then the open events in order
+    uint64_t buffer[3 + perf_events];
+    if (read(fds[0], buffer, sizeof(buffer)) <= 0)
+        return false;
+    sample.time_enabled = buffer[1];
+    sample.time_running = buffer[2];
+    uint64_t member = 0;
+    for (int event = 0; event < perf_events; ++event)
+        sample.values[event] = fds[event] >= 0 and member < buffer[0] ? buffer[3 + member++] : 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+//! Name of each timer in the report and its JSON key, indented by nesting.
+static const char *timer_names[profile_timers][2] = {
+    {"index load", "index_load"},
+    {"spectra", "spectrum"},
+    {"  scoring", "score"},
+    {"    window rows", "window"},
+    {"    fetch spectra", "get_spectrum"},
+    {"      input lock wait", "wait_input_lock"},
+    {"      decode", "decode"},
+    {"      preprocess", "preprocess"},
+    {"  output", "output"},
+    {"    output lock wait", "wait_output_lock"},
+    {"    write", "write"},
+    {"next spectrum lock wait", "wait_next_lock"},
+};
+
+static const char *counter_names[profile_counters] = {
+    "spectra_scored",
+    "cache_hits",
+    "cache_misses",
+    "cache_evictions",
+    "spectra_queued",
+    "queue_depth_sum",
+    "spectra_put",
+};
+
+/*! @param enabled False to make every call return at once.
+ * @param num_threads Number of worker threads.
+ * @param trace_size Spans to keep for each thread, zero not to trace.
+ * @param perf Count hardware events in the stages passed to perf_stop.
+ */
+Profiler::Profiler(bool enabled, int num_threads, size_t trace_size, bool perf)
+    : enabled(enabled)
+    , threads(enabled ? num_threads + 1 : 0)
+    , trace_size(enabled ? trace_size : 0)
+    , perf(enabled and perf)
+    , traces(this->trace_size > 0 ? threads.size() : 0)
+    , start_ns(now_ns())
+{
+    for (auto &profile : threads)
+        memset(&profile, 0, sizeof(profile));
+}
+
+uint64_t Profiler::now_ns(void)
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*! Set the slot the calling thread adds to, in every Profiler.
+ *
+ * @param thread_count Number of the worker thread, or -1 for other threads.
+ */
+void Profiler::set_thread(int thread_count)
+{
+    thread_slot = thread_count + 1;
+}
+
+/*! Read the hardware counters of the calling thread at the start of a
+ * stage, opening them on the first call.
+ */
+PerfSample Profiler::perf_start(void)
+{
+    PerfSample sample;
+    sample.valid = perf and perf_group.read_group(sample);
+    return sample;
+}
+
+/*! Add the hardware events since perf_start to a stage.
+ *
+ * Every event of the group is counted over the same time, so ratios such
+ * as instructions per cycle hold even when the processor time shares its
+ * counters between groups.
+ */
+void Profiler::perf_stop(ProfileTimer timer, const PerfSample &start)
+{
+    PerfSample end;
+    if (!start.valid or !perf_group.read_group(end))
+        return;
+    ThreadProfile &profile = slot();
+    for (int event = 0; event < perf_events; ++event)
+        profile.perf_values[timer][event] += end.values[event] - start.values[event];
+    profile.perf_samples[timer]++;
+    if (end.time_running - start.time_running < end.time_enabled - start.time_enabled)
+        profile.perf_multiplexed++;
+}
+
+/*! Lock a mutex, timing the wait.
+ *
+ * @param lock The mutex to lock. The caller unlocks it.
+ * @param wait Timer for the wait.
+ */
+void Profiler::lock(mutex &lock, ProfileTimer wait)
+{
+    if (!enabled)
+    {
+        lock.lock();
+        return;
+    }
+    uint64_t wait_start = now_ns();
+    lock.lock();
+    stop(wait, wait_start);
+}
+
+/*! Record the depth of the output queue as a scored spectrum is put.
+ * Called with the output lock held.
+ */
+void Profiler::queue_depth(size_t depth)
+{
+    if (!enabled) return;
+    ThreadProfile &profile = slot();
+    profile.counters[profile_puts]++;
+    profile.counters[profile_queue_depth_sum] += depth;
+    profile.max_queue_depth = max(profile.max_queue_depth, uint64_t(depth));
+}
+
+//! @brief Timers and counters summed over all threads.
+ThreadProfile Profiler::total(void) const
+{
+    ThreadProfile sum;
+    memset(&sum, 0, sizeof(sum));
+    for (auto &profile : threads)
+    {
+        for (int timer = 0; timer < profile_timers; ++timer)
+        {
+            sum.timer_ns[timer] += profile.timer_ns[timer];
+            sum.timer_calls[timer] += profile.timer_calls[timer];
+            for (int event = 0; event < perf_events; ++event)
+                sum.perf_values[timer][event] += profile.perf_values[timer][event];
+            sum.perf_samples[timer] += profile.perf_samples[timer];
+        }
+        sum.perf_multiplexed += profile.perf_multiplexed;
+        for (int counter = 0; counter < profile_counters; ++counter)
+            sum.counters[counter] += profile.counters[counter];
+        sum.max_queue_depth = max(sum.max_queue_depth, profile.max_queue_depth);
+    }
+    return sum;
+}
+
+/*! Print a table of the time in each stage and the counters.
+ *
+ * Shares are of the thread time, the wall time by the number of worker
+ * threads, so the stages of a fully busy run add up to about 100%.
+ */
+void Profiler::report(ostream &out) const
+{
+    if (!enabled) return;
+
+    ThreadProfile sum = total();
+    double wall = (now_ns() - start_ns) * 1e-9;
+    size_t workers = max(threads.size() - 1, size_t(1));
+    double thread_time = wall * workers;
+
+    out << "Profile: " << fixed << setprecision(3) << wall << " s wall, " << workers << " threads" << endl;
+    out << left << setw(26) << "stage" << right << setw(12) << "calls" << setw(12) << "total s"
+        << setw(12) << "mean us" << setw(9) << "share" << endl;
+    for (int timer = 0; timer < profile_timers; ++timer)
+    {
+        double seconds = sum.timer_ns[timer] * 1e-9;
+        double mean_us = sum.timer_calls[timer] > 0 ? sum.timer_ns[timer] * 1e-3 / sum.timer_calls[timer] : 0.0;
+        out << left << setw(26) << timer_names[timer][0] << right << setw(12) << sum.timer_calls[timer]
+            << setw(12) << setprecision(3) << seconds << setw(12) << setprecision(1) << mean_us
+            << setw(8) << (thread_time > 0.0 ? 100.0 * seconds / thread_time : 0.0) << "%" << endl;
+    }
+
+    uint64_t lookups = sum.counters[profile_cache_hits] + sum.counters[profile_cache_misses];
+    out << "Spectra scored: " << sum.counters[profile_spectra] << endl;
+    out << "Input cache: " << sum.counters[profile_cache_hits] << " hits, "
+        << sum.counters[profile_cache_misses] << " misses, "
+        << sum.counters[profile_cache_evictions] << " evictions";
+    if (lookups > 0)
+        out << " (hit rate " << setprecision(1) << 100.0 * sum.counters[profile_cache_hits] / lookups << "%)";
+    out << endl;
+    out << "Output queue: " << sum.counters[profile_queued] << " of " << sum.counters[profile_puts]
+        << " spectra queued, mean depth " << setprecision(2)
+        << (sum.counters[profile_puts] > 0 ? double(sum.counters[profile_queue_depth_sum]) / sum.counters[profile_puts] : 0.0)
+        << ", max depth " << sum.max_queue_depth << endl;
+    if (perf)
+        report_perf(out, sum);
+    out.unsetf(ios::floatfield);
+    out << setprecision(6);
+}
+
+/*! Print the hardware events of each stage they were counted in, with
+ * instructions per cycle and the cache and branch miss rates.
+ */
+void Profiler::report_perf(ostream &out, const ThreadProfile &sum) const
+{
+    bool counted = false;
+    for (int timer = 0; timer < profile_timers; ++timer)
+        counted = counted or sum.perf_samples[timer] > 0;
+    if (!counted)
+    {
+        out << "Hardware counters: not available" << endl;
+        return;
+    }
+
+    unsigned unavailable = perf_unavailable;
+    out << left << setw(26) << "hardware counters" << right << setw(12) << "samples" << setw(16) << "cycles"
+        << setw(16) << "instructions" << setw(8) << "IPC" << setw(13) << "cache miss" << setw(14) << "branch miss" << endl;
+    for (int timer = 0; timer < profile_timers; ++timer)
+    {
+        if (sum.perf_samples[timer] == 0)
+            continue;
+        const uint64_t *values = sum.perf_values[timer];
+        out << left << setw(26) << timer_names[timer][0] << right << setw(12) << sum.perf_samples[timer]
+            << setw(16) << values[perf_cycles];
+        if (unavailable & (1u << perf_instructions))
+            out << setw(16) << "n/a" << setw(8) << "n/a";
+        else
+            out << setw(16) << values[perf_instructions] << setw(8) << setprecision(2)
+                << (values[perf_cycles] > 0 ? double(values[perf_instructions]) / values[perf_cycles] : 0.0);
+        if (unavailable & (1u << perf_cache_references | 1u << perf_cache_misses))
+            out << setw(13) << "n/a";
+        else
+            out << setw(12) << setprecision(1)
+                << (values[perf_cache_references] > 0 ? 100.0 * values[perf_cache_misses] / values[perf_cache_references] : 0.0) << "%";
+        if (unavailable & (1u << perf_branches | 1u << perf_branch_misses))
+            out << setw(14) << "n/a";
+        else
+            out << setw(13) << setprecision(2)
+                << (values[perf_branches] > 0 ? 100.0 * values[perf_branch_misses] / values[perf_branches] : 0.0) << "%";
+        out << endl;
+    }
+    if (sum.perf_multiplexed > 0)
+        out << "Hardware counters were time shared in " << sum.perf_multiplexed
+            << " samples, so the counts are partial but their ratios hold" << endl;
+}
+
+//! @brief Timers and counters of one thread as JSON members.
+void Profiler::write_json_profile(ostream &out, const ThreadProfile &profile) const
+{
+    out << "\"timers\": {";
+    for (int timer = 0; timer < profile_timers; ++timer)
+    {
+        out << (timer > 0 ? ", " : "") << "\"" << timer_names[timer][1] << "\": {\"seconds\": "
+            << profile.timer_ns[timer] * 1e-9 << ", \"calls\": " << profile.timer_calls[timer] << "}";
+    }
+    out << "}, \"counters\": {";
+    for (int counter = 0; counter < profile_counters; ++counter)
+    {
+        out << (counter > 0 ? ", " : "") << "\"" << counter_names[counter] << "\": " << profile.counters[counter];
+    }
+    out << "}, \"max_queue_depth\": " << profile.max_queue_depth;
+    if (perf)
+    {
+        out << ", \"perf\": {";
+        bool first = true;
+        for (int timer = 0; timer < profile_timers; ++timer)
+        {
+            if (profile.perf_samples[timer] == 0)
+                continue;
+            out << (first ? "" : ", ") << "\"" << timer_names[timer][1] << "\": {\"samples\": " << profile.perf_samples[timer];
+            for (int event = 0; event < perf_events; ++event)
+            {
+                if (!(perf_unavailable & (1u << event)))
+                    out << ", \"" << perf_names[event] << "\": " << profile.perf_values[timer][event];
+            }
+            out << "}";
+            first = false;
+        }
+        out << "}";
+    }
+}
+
+/*! Write the totals, and the timers and counters of each thread, as JSON.
+ * Thread zero is the main thread (and a live reader), then the workers.
+ */
+void Profiler::write_json(ostream &out) const
+{
+    if (!enabled) return;
+
+    out << "{" << endl;
+    out << "  \"wall_seconds\": " << (now_ns() - start_ns) * 1e-9 << "," << endl;
+    out << "  \"threads\": " << threads.size() - 1 << "," << endl;
+    out << "  \"total\": {";
+    write_json_profile(out, total());
+    out << "}," << endl;
+    out << "  \"per_thread\": [" << endl;
+    for (size_t slot_idx = 0; slot_idx < threads.size(); ++slot_idx)
+    {
+        out << "    {\"thread\": " << slot_idx << ", ";
+        write_json_profile(out, threads[slot_idx]);
+        out << "}" << (slot_idx + 1 < threads.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+}
+
+/*! Write the traced spans as Chrome trace event JSON, which trace viewers
+ * such as Perfetto and chrome://tracing load. Each slot is a thread, and
+ * each span a complete event with the spectrum it worked on.
+ */
+void Profiler::write_trace(ostream &out) const
+{
+    // spans overwritten once a ring buffer wrapped
+    uint64_t dropped = 0;
+    for (auto &profile : threads)
+        dropped += profile.trace_count > trace_size ? profile.trace_count - trace_size : 0;
+
+    out << "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_spans\": " << dropped << "}, \"traceEvents\": [" << endl;
+    out << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"HiTIME\"}}";
+    for (size_t slot_idx = 0; slot_idx < traces.size(); ++slot_idx)
+    {
+        string name = slot_idx == 0 ? "main" : "worker " + to_string(slot_idx - 1);
+        out << "," << endl << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << slot_idx
+            << ", \"args\": {\"name\": \"" << name << "\"}}";
+    }
+
+    out << fixed << setprecision(3);
+    for (size_t slot_idx = 0; slot_idx < traces.size(); ++slot_idx)
+    {
+        // oldest span first, once the ring buffer has wrapped
+        uint64_t count = threads[slot_idx].trace_count;
+        uint64_t first = count > trace_size ? count - trace_size : 0;
+        for (uint64_t span_idx = first; span_idx < count; ++span_idx)
+        {
+            const TraceSpan &span = traces[slot_idx][span_idx % trace_size];
+            out << "," << endl << "  {\"name\": \"" << timer_names[span.timer][1] << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << slot_idx
+                << ", \"ts\": " << span.start_ns * 1e-3 << ", \"dur\": " << span.duration_ns * 1e-3;
+            if (span.spectrum >= 0)
+                out << ", \"args\": {\"spectrum\": " << span.spectrum << "}";
+            out << "}";
+        }
+    }
+    out << endl << "]}" << endl;
+    out.unsetf(ios::floatfield);
+    out << setprecision(6);
+}
@@ -0,0 +1,175 @@
+#ifndef HITIME_PROFILE_H
+#define HITIME_PROFILE_H
+
+/*
+ * Per-stage timers and counters of a scoring run ('--profile'), a
+ * timeline of the timed spans of each thread ('--trace'), and hardware
+ * performance counters of selected stages ('--perf').
+ *
+ * Each thread adds to its own slot, so the hot paths take no locks and
+ * share no cache lines. When profiling is off every call returns at once
+ * without reading the clock.
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*! Timed stages. Stages nest within the stages above them, as indented in
+ * the report. Spectra are fetched (input lock, decode and preprocess) mostly
+ * while collecting the window rows, so those times overlap.
+ */
+enum ProfileTimer
+{
+    profile_index_load, //!< Loading the input index
+    profile_spectrum, //!< Scoring one centre spectrum, including its output
+    profile_score, //!< Scoring the centre points of one spectrum
+    profile_window, //!< Collecting the rows of a window
+    profile_get_spectrum, //!< Fetching a spectrum from the input cache, or decoding it
+    profile_wait_input, //!< Waiting for the input spectrum lock
+    profile_decode, //!< Decoding a spectrum missing from the cache
+    profile_preprocess, //!< Preprocessing a decoded spectrum
+    profile_output, //!< Queueing and writing scored spectra
+    profile_wait_output, //!< Waiting for the output lock
+    profile_write, //!< Writing scored spectra in order
+    profile_wait_next, //!< Waiting for the next spectrum lock
+    profile_timers //!< Number of timers
+};
+
+//! Counted events.
+enum ProfileCounter
+{
+    profile_spectra, //!< Centre spectra scored
+    profile_cache_hits, //!< Spectra found in the input cache
+    profile_cache_misses, //!< Spectra decoded into the input cache
+    profile_cache_evictions, //!< Spectra dropped from the full input cache
+    profile_queued, //!< Scored spectra queued to wait for earlier spectra
+    profile_queue_depth_sum, //!< Output queue depth summed over each put
+    profile_puts, //!< Scored spectra put to the output
+    profile_counters //!< Number of counters
+};
+
+//! Hardware events counted by '--perf', in one group so their ratios are exact.
+enum PerfEvent
+{
+    perf_cycles,
+    perf_instructions,
+    perf_cache_references,
+    perf_cache_misses,
+    perf_branches,
+    perf_branch_misses,
+    perf_events //!< Number of events
+};
+
+//! Hardware counter values at the start of a stage.
+struct PerfSample
+{
+    bool valid; //!< False if the counters are off or could not be read
+    uint64_t time_enabled; //!< Time the group was enabled, and running on the counters
+    uint64_t time_running;
+    uint64_t values[perf_events];
+};
+
+//! Timers and counters of one thread, padded to its own cache lines.
+struct alignas(64) ThreadProfile
+{
+    uint64_t timer_ns[profile_timers];
+    uint64_t timer_calls[profile_timers];
+    uint64_t counters[profile_counters];
+    uint64_t max_queue_depth;
+    uint64_t trace_count; //!< Spans recorded in this thread's trace, including overwritten spans
+    uint64_t perf_values[profile_timers][perf_events]; //!< Hardware events counted in each stage
+    uint64_t perf_samples[profile_timers]; //!< Stages the hardware events were counted over
+    uint64_t perf_multiplexed; //!< Samples taken while the counter group was time shared
+};
+
+//! A timed span of one thread, for the trace.
+struct TraceSpan
+{
+    uint64_t start_ns; //!< Since the Profiler was constructed
+    uint64_t duration_ns;
+    int32_t spectrum; //!< Spectrum the span worked on, or -1
+    int32_t timer;
+};
+
+/*! Timers and counters for each thread of a run.
+ *
+ * Worker threads call set_thread with their number. Other threads (the
+ * main thread, the live reader) share slot zero, which is only used by one
+ * of them at a time.
+ *
+ * When tracing, each slot also records its spans in a ring buffer of its
+ * own, keeping the latest trace_size spans. The ring grows as spans are
+ * recorded, so a short run does not pay for the whole of it. Only the
+ * owning thread writes to it, so recording needs no locks or atomics.
+ */
+class Profiler
+{
+private:
+    bool enabled;
+    std::vector<ThreadProfile> threads; //!< Slot zero, then one per worker thread
+    size_t trace_size; //!< Spans kept for each thread, zero when not tracing
+    bool perf; //!< Count hardware events, if the system permits
+    std::vector<std::vector<TraceSpan>> traces; //!< Ring buffer of spans of each slot, up to trace_size
+    uint64_t start_ns;
+    static thread_local int thread_slot;
+
+    size_t slot_index(void) const { return size_t(thread_slot) < threads.size() ? thread_slot : 0; }
+    ThreadProfile &slot(void) { return threads[slot_index()]; }
+    static uint64_t now_ns(void);
+    void write_json_profile(std::ostream &out, const ThreadProfile &profile) const;
+    void report_perf(std::ostream &out, const ThreadProfile &sum) const;
+
+public:
+    Profiler(bool enabled, int num_threads, size_t trace_size = 0, bool perf = false);
+    bool is_enabled(void) const { return enabled; }
+    static void set_thread(int thread_count);
+
+    //! @brief Start of a timed stage, to pass to stop. Zero if profiling is off.
+    uint64_t start(void) const { return enabled ? now_ns() : 0; }
+
+    /*! @brief Add the time since start to a stage, and trace the span.
+     *
+     * @param spectrum Spectrum the stage worked on, for the trace.
+     */
+    void stop(ProfileTimer timer, uint64_t start, int spectrum = -1)
+    {
+        if (!enabled) return;
+        uint64_t end = now_ns();
+        size_t slot_idx = slot_index();
+        ThreadProfile &profile = threads[slot_idx];
+        profile.timer_ns[timer] += end - start;
+        profile.timer_calls[timer]++;
+        if (trace_size > 0)
+        {
+            std::vector<TraceSpan> &trace = traces[slot_idx];
+            if (trace.size() < trace_size)
+                trace.emplace_back();
+            TraceSpan &span = trace[profile.trace_count % trace_size];
+            span.start_ns = start - start_ns;
+            span.duration_ns = end - start;
+            span.spectrum = spectrum;
+            span.timer = timer;
+            profile.trace_count++;
+        }
+    }
+
+    //! @brief Count events.
+    void count(ProfileCounter counter, uint64_t events = 1)
+    {
+        if (enabled) slot().counters[counter] += events;
+    }
+
+    PerfSample perf_start(void);
+    void perf_stop(ProfileTimer timer, const PerfSample &start);
+    void lock(std::mutex &lock, ProfileTimer wait);
+    void queue_depth(size_t depth);
+    ThreadProfile total(void) const;
+    void report(std::ostream &out) const;
+    void write_json(std::ostream &out) const;
+    void write_trace(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "constants.h"
+#include "json.h"
+#include "progress.h"
+
+using namespace std;
+
+//! @brief Format seconds as hours:minutes:seconds.
+static string format_duration(double seconds)
+{
+    long whole = lround(seconds);
+    ostringstream out;
+    out << whole / 3600 << ":" << setfill('0') << setw(2) << (whole / 60) % 60 << ":" << setw(2) << whole % 60;
+    return out.str();
+}
+
+/*! @param interval Seconds between reports, progress is off if not positive.
+ * @param print Print each report to stderr.
+ * @param status_file File to rewrite with each report as JSON, empty for none.
+ * @param label Names the run in each report, e.g. the input file.
+ */
+Progress::Progress(double interval, bool print, const string &status_file, const string &label)
+    : enabled(interval > 0.0 and (print or status_file != ""))
+    , label(label)
+    , interval(interval)
+    , print(print)
+    , status_file(status_file)
+    , total(0)
+    , spectra(0)
+    , peaks(0)
+    , cache_hits(0)
+    , cache_misses(0)
+    , last_spectra(0)
+    , last_peaks(0)
+    , stopping(false)
+{
+}
+
+Progress::~Progress()
+{
+    stop();
+}
+
+/*! Start the reporter thread.
+ *
+ * @param total Spectra to score, zero if not known, as in live mode.
+ */
+void Progress::start(uint64_t total)
+{
+    if (!enabled or reporter.joinable())
+        return;
+    this->total = total;
+    start_time = chrono::steady_clock::now();
+    last_time = start_time;
+    reporter = thread(&Progress::run, this);
+}
+
+/*! Stop the reporter thread, with a last report of the whole run.
+ */
+void Progress::stop(void)
+{
+    if (!reporter.joinable())
+        return;
+    reporter_lock.lock();
+    stopping = true;
+    reporter_lock.unlock();
+    reporter_changed.notify_all();
+    reporter.join();
+    report(true);
+}
+
+/*! Report every interval until stopped. Waits on a condition variable
+ * rather than sleeping, so stopping does not wait out the interval.
+ */
+void Progress::run(void)
+{
+    unique_lock<mutex> lock(reporter_lock);
+    auto wake = chrono::steady_clock::now();
+    while (!stopping)
+    {
+        wake += chrono::microseconds(llround(interval * 1e6));
+        if (reporter_changed.wait_until(lock, wake, [this] { return stopping; }))
+            break;
+        lock.unlock();
+        report(false);
+        lock.lock();
+    }
+}
+
+/*! Report the rates since the last report, and the time left at the
+ * average rate since the start.
+ *
+ * @param finished Report the whole run, once scoring has ended.
+ */
+void Progress::report(bool finished)
+{
+    auto now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - start_time).count();
+    double since_last = chrono::duration<double>(now - last_time).count();
+    uint64_t spectra_done = spectra.load(memory_order_relaxed);
+    uint64_t peaks_done = peaks.load(memory_order_relaxed);
+    uint64_t hits = cache_hits.load(memory_order_relaxed);
+    uint64_t lookups = hits + cache_misses.load(memory_order_relaxed);
+
+    // a finished run reports its average rates
+    double span = finished ? elapsed : since_last;
+    double spectra_rate = span > 0.0 ? (spectra_done - (finished ? 0 : last_spectra)) / span : 0.0;
+    double peak_rate = span > 0.0 ? (peaks_done - (finished ? 0 : last_peaks)) / span : 0.0;
+    double hit_rate = lookups > 0 ? double(hits) / lookups : -1.0;
+    double eta = -1.0;
+    if (total > 0 and spectra_done > 0)
+        eta = finished ? 0.0 : elapsed * (double(total) - spectra_done) / spectra_done;
+    last_time = now;
+    last_spectra = spectra_done;
+    last_peaks = peaks_done;
+
+    if (print)
+    {
+        ostringstream line;
+        line << program_name << (finished ? " finished " : " progress ") << label << ": " << spectra_done;
+        if (total > 0)
+            line << "/" << total << " spectra (" << fixed << setprecision(1) << 100.0 * spectra_done / total << "%)";
+        else
+            line << " spectra";
+        line << fixed << setprecision(1) << ", " << spectra_rate << " spectra/s, "
+             << scientific << setprecision(3) << peak_rate << " points/s" << fixed << setprecision(1);
+        if (hit_rate >= 0.0)
+            line << ", cache hits " << 100.0 * hit_rate << "%";
+        line << ", elapsed " << format_duration(elapsed);
+        if (!finished and eta >= 0.0)
+            line << ", ETA " << format_duration(eta);
+        cerr << line.str() << endl;
+    }
+
+    if (status_file != "")
+        write_status(finished, elapsed, spectra_rate, peak_rate, hit_rate, eta);
+}
+
+/*! Rewrite the status file as one JSON object. It is written to a
+ * temporary file then renamed over the status file, so a reader never
+ * sees a partial report. Unknown values are null.
+ */
+void Progress::write_status(bool finished, double elapsed, double spectra_rate, double peak_rate,
+                            double hit_rate, double eta) const
+{
+    string temp_file = status_file + ".tmp";
+    ofstream status_fs(temp_file);
+    if (!status_fs)
+    {
+        cerr << program_name << " WARNING: cannot write status file " << temp_file << endl;
+        return;
+    }
+    uint64_t spectra_done = spectra.load(memory_order_relaxed);
+    status_fs << "{\"state\": \"" << (finished ? "finished" : "running") << "\""
+              << ", \"input\": " << json_string(label)
+              << ", \"spectra_done\": " << spectra_done
+              << ", \"spectra_total\": ";
+    if (total > 0)
+        status_fs << total << ", \"percent\": " << 100.0 * spectra_done / total;
+    else
+        status_fs << "null, \"percent\": null";
+    status_fs << ", \"points_done\": " << peaks.load(memory_order_relaxed)
+              << ", \"elapsed_seconds\": " << elapsed
+              << ", \"spectra_per_second\": " << spectra_rate
+              << ", \"points_per_second\": " << peak_rate
+              << ", \"cache_hit_rate\": ";
+    if (hit_rate >= 0.0)
+        status_fs << hit_rate;
+    else
+        status_fs << "null";
+    status_fs << ", \"eta_seconds\": ";
+    if (eta >= 0.0)
+        status_fs << eta;
+    else
+        status_fs << "null";
+    status_fs << ", \"updated\": " << time(nullptr) << "}" << endl;
+    status_fs.close();
+    if (rename(temp_file.c_str(), status_file.c_str()) != 0)
+        cerr << program_name << " WARNING: cannot replace status file " << status_file << endl;
+}
@@ -0,0 +1,78 @@
+#ifndef HITIME_PROGRESS_H
+#define HITIME_PROGRESS_H
+
+/*
+ * Progress of a scoring run ('--progress', '--status-file'): spectra and
+ * points scored, the input cache hit rate and the time left, reported
+ * periodically by a thread of its own.
+ *
+ * The scoring threads only add to relaxed atomic counters, so reporting
+ * never holds them up. When progress is off every call returns at once.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*! Counts the work done by the scoring threads, and reports it every
+ * interval on stderr and to a status file, from a reporter thread started
+ * by start and stopped by stop.
+ */
+class Progress
+{
+private:
+    bool enabled;
+    std::string label; //!< Names the run in each report
+    double interval; //!< Seconds between reports
+    bool print; //!< Print each report to stderr
+    std::string status_file; //!< File to rewrite with each report as JSON, empty for none
+    uint64_t total; //!< Spectra to score, zero if not known
+    std::atomic<uint64_t> spectra; //!< Centre spectra scored
+    std::atomic<uint64_t> peaks; //!< Centre points scored
+    std::atomic<uint64_t> cache_hits;
+    std::atomic<uint64_t> cache_misses;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point last_time; //!< Time of the last report
+    uint64_t last_spectra; //!< Spectra scored at the last report
+    uint64_t last_peaks;
+    std::thread reporter;
+    std::mutex reporter_lock;
+    std::condition_variable reporter_changed; //!< Signalled to stop the reporter
+    bool stopping;
+
+    void run(void);
+    void report(bool finished);
+    void write_status(bool finished, double elapsed, double spectra_rate, double peak_rate,
+                      double hit_rate, double eta) const;
+
+public:
+    Progress(double interval, bool print, const std::string &status_file, const std::string &label);
+    ~Progress();
+    bool is_enabled(void) const { return enabled; }
+    void start(uint64_t total);
+    void stop(void);
+
+    //! @brief Count a centre spectrum scored.
+    void add_spectrum(void)
+    {
+        if (enabled) spectra.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! @brief Count the centre points of a spectrum being scored.
+    void add_peaks(uint64_t count)
+    {
+        if (enabled) peaks.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    //! @brief Count an input spectrum found in, or decoded into, the cache.
+    void cache_lookup(bool hit)
+    {
+        if (enabled) (hit ? cache_hits : cache_misses).fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+#endif
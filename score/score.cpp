@@ -1,108 +1,646 @@
-#include <OpenMS/FORMAT/IndexedMzMLFileLoader.h>
 #include <OpenMS/KERNEL/Peak1D.h>
+#include <OpenMS/FORMAT/MzMLFile.h>
+#include <OpenMS/INTERFACES/IMSDataConsumer.h>
 #include <mutex>
 #include <iostream>
 #include <map>
 #include <thread>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "vector.h"
+#include "kernel.h"
 #include "options.h"
 #include "constants.h"
 #include "lru_cache.h"
+#include "preprocess.h"
+#include "merge.h"
 #include "score.h"
 
 using namespace OpenMS;
 using namespace std;
 
-mutex output_spectrum_lock;
-mutex next_spectrum_lock;
-mutex input_spectrum_lock;
-
-
-Scorer::Scorer(bool debug, bool list_max, double intensity_ratio, double rt_width, 
-               double mz_width, double mz_delta,
-               double confidence,
-               int num_threads, int input_spectrum_cache_size, string in_file, string out_file)
-   : debug(debug)
-   , list_max(list_max)
-   , intensity_ratio(intensity_ratio)
-   , rt_width(rt_width)
-   , mz_width(mz_width)
-   , mz_delta(mz_delta)
-   , num_threads(num_threads)
-   , confidence(confidence)
-   , in_file(in_file)
-   , out_file(out_file)
-   , input_spectrum_cache(input_spectrum_cache_size)
-   , spectrum_writer(out_file)
+/*! Passes the spectra of a live input to the Scorer as they are parsed.
+ */
+class LiveConsumer : public Interfaces::IMSDataConsumer
+{
+private:
+   Scorer &scorer;
+
+public:
+   LiveConsumer(Scorer &scorer) : scorer(scorer) {}
+   void consumeSpectrum(SpectrumType &spectrum)
+   {
+      // stop parsing once scoring has failed
+      if (!scorer.add_live_spectrum(spectrum))
+         throw runtime_error("scoring stopped");
+   }
+   void consumeChromatogram(ChromatogramType &) {}
+   void setExpectedSize(Size, Size) {}
+   void setExperimentalSettings(const ExperimentalSettings &) {}
+};
+
+/*! Derive an output file name from the user supplied one.
+ *
+ * @param out_file Output file name given on the command line.
+ * @param suffix Text to insert before the file extension.
+ * @param extension Replacement extension, keep the original if empty.
+ *
+ * @return The new file name.
+ */
+static string output_filename(const string &out_file, const string &suffix, string extension = "")
+{
+   size_t dot = out_file.find_last_of('.');
+   if (extension == "" and dot != string::npos)
+      extension = out_file.substr(dot);
+   return out_file.substr(0, dot) + suffix + extension;
+}
+
+/*! Set up scoring of one input.
+ *
+ * @param opts Scoring options.
+ * @param input The spectra to score, e.g. a file already loaded by a server
+ * or spectra in memory. If null they are loaded from opts.in_file, or in
+ * live mode read from it, or passed to add_live_spectrum if it is empty.
+ * @param score_callback Receives the scored spectra instead of the output
+ * files, if set.
+ */
+Scorer::Scorer(const Options &opts, SpectrumSourcePtr input, ScoreCallback score_callback)
+   : debug(opts.debug)
+   , list_max(opts.list_max)
+   , discover(opts.discover)
+   , discover_min_delta(opts.discover_min_delta)
+   , discover_max_delta(opts.discover_max_delta)
+   , discover_bin_width(opts.discover_bin_width)
+   , discover_peaks(opts.discover_peaks)
+   , discover_top(opts.discover_top)
+   , rt_width(opts.rt_width)
+   , mz_width(opts.mz_width)
+   , models(opts.models)
+   , max_members(1)
+   , param_sets(opts.param_sets)
+   , sweep_file(opts.sweep_file)
+   , targets(opts.targets)
+   , spectrum_start(opts.spectrum_start)
+   , spectrum_end(opts.spectrum_end)
+   , rt_start(opts.rt_start)
+   , rt_end(opts.rt_end)
+   , mz_start(opts.mz_start)
+   , mz_end(opts.mz_end)
+   , trim_mz(false)
+   , ms_level(opts.ms_level)
+   , polarity(opts.polarity)
+   , scan_filter(opts.scan_filter)
+   , centroid(opts.centroid)
+   , strip_zeros(opts.strip_zeros)
+   , noise_mad(opts.noise_mad)
+   , keep_boundary_zeros(opts.keep_boundary_zeros)
+   , screen_threshold(opts.screen_threshold)
+   , screen_report(opts.screen_report)
+   , verify_fraction(opts.verify)
+   , verify_centres(0)
+   , verify_both_zero(0)
+   , verify_zero_fast(0)
+   , verify_zero_screened(0)
+   , verify_zero_reference(0)
+   , verify_max_error(0.0)
+   , verify_max_rt(0.0)
+   , verify_max_mz(0.0)
+   , verify_max_fast(0.0)
+   , verify_max_reference(0.0)
+   , screen_passed{0}
+   , screen_rejected{0}
+   , screen_kept_scores{0}
+   , screen_dropped_scores{0}
+   , num_threads(opts.num_threads)
+   , in_file(opts.in_file)
+   , out_file(opts.out_file)
+   , input(input)
+   , score_callback(score_callback)
+   , checkpoint_interval(score_callback ? 0 : opts.checkpoint_interval)
+   , resume(opts.resume)
+   , output_part(0)
+   , last_checkpoint_id(0)
+   , input_spectrum_cache(opts.input_spectrum_cache_size)
+   , live(opts.live)
+   , live_ended(false)
+   , run_failed(false)
+   , profiler(opts.profile or opts.trace_file != "", opts.num_threads,
+              opts.trace_file != "" ? opts.trace_spans : 0, opts.perf)
+   , profile(opts.profile)
+   , profile_json(opts.profile_json)
+   , trace_file(opts.trace_file)
+   , progress(opts.progress or opts.status_file != "" ? opts.progress_interval : 0.0, opts.progress,
+              opts.status_file, opts.in_file)
    , current_spectrum_id{0}
    , next_output_spectrum_id{0}
 {
 
-   if (list_max)
+   if (discover)
    {
-      // quick and dirty change out_file extension to .csv
-      string csv_out_filename = out_file.substr(0,out_file.find_last_of('.'))+".csv";
-      csv_fs.open (csv_out_filename);
-      csv_fs.exceptions(ofstream::badbit | ofstream::failbit);
+      // Discovery reports candidate deltas rather than scored spectra
+      delta_histogram.resize(ceil((discover_max_delta - discover_min_delta) / discover_bin_width));
+   }
+   else if (list_max)
+   {
+      output_files.push_back(out_file);
+   }
+   else
+   {
+      // Every model is scored with every parameter set in the same pass
+      // over the input, each into its own output file
+      for (Size set_idx = 0; set_idx < param_sets.size(); ++set_idx)
+      {
+         string set_label = param_sets.size() > 1 ? "_s" + to_string(set_idx + 1) : "";
+         for (auto &model : models)
+         {
+            string model_label = models.size() > 1 ? model.label : "";
+            output_files.push_back(output_filename(out_file, set_label + model_label));
+         }
+      }
+   }
+
+   output_points.resize(output_files.size());
+   output_score_sum.resize(output_files.size());
+   output_score_max.resize(output_files.size());
+
+   for (auto &model : models)
+   {
+      max_members = max(max_members, model.offsets.size() + 1);
    }
 
-   IndexedMzMLFileLoader mzml;
    rt_sigma = default_rt_sigma;
    mz_sigma = default_mz_sigma;
 
-   mzml.load(in_file, input_map);
+   if (!input and !live)
+   {
+      uint64_t load_start = profiler.start();
+      this->input = make_shared<InputFile>(in_file);
+      profiler.stop(profile_index_load, load_start);
+   }
 
-   half_window = ceil(rt_sigma * rt_width / std_dev_in_fwhm);
-   num_spectra = input_map.getNrSpectra();
+   // Select spectra and find their retention times from the index metadata,
+   // so that spectra are not decoded just for that, and spectra which are
+   // not selected are never read at all. Live spectra are selected as they
+   // are read instead.
+   const PeakMap *meta_data = live ? nullptr : this->input->get_meta_data();
+   bool have_meta_data = meta_data and meta_data->size() == this->input->size();
+   if (!live and !have_meta_data and (ms_level > 0 or polarity != 0 or scan_filter != ""))
+   {
+      throw runtime_error("selecting spectra needs the spectrum metadata of the input index");
+   }
+   for (Size file_id = 0; !live and file_id < this->input->size(); ++file_id)
+   {
+      if (have_meta_data)
+      {
+         const PeakSpectrum &meta_spectrum = (*meta_data)[file_id];
+         if (!select_spectrum(meta_spectrum))
+            continue;
+         spectrum_rts.push_back(meta_spectrum.getRT());
+      }
+      selected_spectra.push_back(file_id);
+   }
+
+   sort(targets.begin(), targets.end(),
+        [](const Target &a, const Target &b) { return a.mz < b.mz; });
+
+   int max_half_window = 0;
+
+   for (auto &params : param_sets)
+   {
+      params.half_window = ceil(rt_sigma * params.rt_width / std_dev_in_fwhm);
+      params.min_sample = params.half_window;
+      max_half_window = max(max_half_window, params.half_window);
+
+      // Spacing should be based on scan intervals
+      // (curently assumed fixed spacing)
+      double local_rt_sigma = params.rt_width / std_dev_in_fwhm;
+      Size set_rows = (2 * params.half_window) + 1;
+      params.rt_shape.resize(set_rows);
+
+      // Calculate Gaussian shape in the RT direction
+      for (Size i = 0; i < set_rows; ++i)
+      {
+         double pt = (i - params.half_window) / local_rt_sigma;
+         pt = -0.5 * pt * pt;
+         double fit = exp(pt) / (local_rt_sigma * root2pi);
+         params.rt_shape[i] = fit;
+      }
+   }
+
+   // Local maxima use the command line RT width, when scoring the window
+   // collected for each centre is wide enough for every parameter set
+   if (list_max or discover)
+      half_window = ceil(rt_sigma * rt_width / std_dev_in_fwhm);
+   else
+      half_window = max_half_window;
+
+   // All spectrum ids from here on are positions in the selected spectra,
+   // so RT windows are built over the selected spectra only
+   num_spectra = selected_spectra.size();
    local_rows = (2 * half_window) + 1;
 
-   Size min_sample = half_window;
+   // Only centre spectra in the spectrum and retention time ranges are
+   // scored, the windows read the half_window spectra either side of them
+   // as well, so consecutive spectrum ranges join up to a whole run
+   first_centre_id = min(spectrum_start, int(num_spectra));
+   end_centre_id = min(spectrum_end, int(num_spectra));
+   if (rt_start > -numeric_limits<double>::max() or rt_end < numeric_limits<double>::max())
+   {
+      if (spectrum_rts.size() != num_spectra)
+      {
+         throw runtime_error("a retention time range needs the spectrum metadata of the input index");
+      }
+      int range_end = end_centre_id;
+      while (first_centre_id < range_end and spectrum_rts[first_centre_id] < rt_start)
+         first_centre_id++;
+      end_centre_id = first_centre_id;
+      while (end_centre_id < range_end and spectrum_rts[end_centre_id] <= rt_end)
+         end_centre_id++;
+   }
+   if (live)
+   {
+      // the number of spectra is only known at the end of the input. Hold
+      // enough spectra for the window of the next spectrum to write, and one
+      // centre for each other thread, so scoring always makes progress.
+      end_centre_id = numeric_limits<int>::max();
+      live_capacity = max(Size(opts.input_spectrum_cache_size), local_rows + num_threads);
+   }
+   current_spectrum_id = first_centre_id;
+   next_output_spectrum_id = first_centre_id;
+
+   // A checkpointed run writes its output in parts, resuming after the
+   // last complete part
+   checkpoint_file = output_filename(out_file, "", ".checkpoint");
+   streamoff csv_size = 0;
+   if (resume)
+   {
+      string checkpoint_error = read_checkpoint(csv_size);
+      if (checkpoint_error != "")
+      {
+         throw runtime_error(checkpoint_error);
+      }
+   }
+   last_checkpoint_id = next_output_spectrum_id;
+   current_spectrum_id = next_output_spectrum_id;
 
-   vector<thread> threads(num_threads);
+   if (list_max and !score_callback)
+   {
+      // quick and dirty change out_file extension to .csv
+      string csv_file = output_filename(out_file, "", ".csv");
+      if (csv_size > 0)
+      {
+         // drop the lines written after the checkpoint
+         if (truncate(csv_file.c_str(), csv_size) != 0)
+         {
+            throw runtime_error(string("cannot resume, the output ") + csv_file + " is missing");
+         }
+         csv_fs.open(csv_file, ofstream::app);
+      }
+      else
+      {
+         csv_fs.open(csv_file);
+      }
+      csv_fs.exceptions(ofstream::badbit | ofstream::failbit);
+   }
+   open_writers();
+
+   // Points which cannot take part in scoring centres in the M/Z range are
+   // removed as spectra are read
+   if (mz_start > 0.0 or mz_end < numeric_limits<double>::max())
+   {
+      trim_mz = true;
+      if (list_max)
+      {
+         load_mz_lower = mz_start - mz_width;
+         load_mz_upper = mz_end + mz_width;
+      }
+      else if (discover)
+      {
+         load_mz_lower = mz_start;
+         load_mz_upper = mz_end;
+      }
+      else
+      {
+         double max_offset = 0.0;
+         double max_tol = 0.0;
+         for (auto &model : models)
+         {
+            for (auto offset : model.offsets)
+               max_offset = max(max_offset, offset);
+         }
+         for (auto &params : param_sets)
+         {
+            max_tol = max(max_tol, mz_sigma * params.mz_width / (std_dev_in_fwhm * 1e6));
+         }
+         load_mz_lower = mz_start * (1.0 - max_tol);
+         load_mz_upper = (mz_end + max_offset) * (1.0 + max_tol);
+      }
+   }
+
+   // in live mode the number of spectra is only known at the end
+   if (current_spectrum_id < end_centre_id)
+      progress.start(live ? 0 : end_centre_id - current_spectrum_id);
+}
+
+/*! Score the whole input with this Scorer's own threads, then finish.
+ */
+void Scorer::run(void)
+{
+   start();
+   wait();
+}
+
+/*! Start scoring in the background, with this Scorer's own threads.
+ *
+ * In live mode without an input file, pass the spectra to add_live_spectrum
+ * and call end_live_input after the last one.
+ */
+void Scorer::start(void)
+{
+   threads.resize(num_threads);
+
+   if (live and in_file != "")
+      reader = thread(&Scorer::read_live, this);
 
    for (int thread_count = 0; thread_count < num_threads; thread_count++)
    {
       threads[thread_count] = thread(&Scorer::score_worker, this, thread_count);
     
    }
+}
 
+/*! Wait for every spectrum to be scored, then finish.
+ *
+ * An error in a scoring thread stops scoring, and is thrown again here.
+ */
+void Scorer::wait(void)
+{
    for (int thread_count = 0; thread_count < num_threads; thread_count++)
    {
        threads[thread_count].join();
    }
 
-   if (list_max)
+   if (reader.joinable())
+      reader.join();
+
+   if (run_error)
+      rethrow_exception(run_error);
+
+   finish();
+}
+
+/*! Close the outputs and write the reports, once every spectrum is scored.
+ */
+void Scorer::finish(void)
+{
+   progress.stop();
+
+   if (csv_fs.is_open())
       csv_fs.close();
+
+   // the writers complete their files when released
+   spectrum_writers.clear();
+
+   if (checkpoint_interval > 0)
+   {
+      // join the parts into the output a run without checkpoints writes
+      for (Size output_idx = 0; output_idx < output_files.size(); ++output_idx)
+      {
+         vector<string> parts;
+         for (int part = 0; part <= output_part; ++part)
+            parts.push_back(part_filename(output_idx, part));
+         merge_mzml_files(parts, output_files[output_idx]);
+         for (auto &part_file : parts)
+            remove(part_file.c_str());
+      }
+      remove(checkpoint_file.c_str());
+   }
+
+   if (discover)
+      report_deltas();
+
+   if (sweep_file != "" and out_file != "")
+      write_sweep_summary();
+
+   if (screen_threshold > 0.0)
+      report_screen();
+
+   if (verify_fraction > 0.0)
+      report_verify();
+
+   if (profile)
+      report_profile();
+
+   if (trace_file != "")
+      write_trace();
+}
+
+/*! Open a spectrum writer for each output, writing the current part of the
+ * output when checkpointing.
+ */
+void Scorer::open_writers(void)
+{
+   if (score_callback)
+      return;
+
+   for (Size output_idx = 0; output_idx < output_files.size(); ++output_idx)
+   {
+      string file_name = checkpoint_interval > 0 ? part_filename(output_idx, output_part) : output_files[output_idx];
+      spectrum_writers.push_back(make_shared<PlainMSDataWritingConsumer>(file_name));
+   }
+}
+
+//! @brief File name of one part of an output, when checkpointing.
+string Scorer::part_filename(Size output_idx, int part)
+{
+   return output_filename(output_files[output_idx], ".part" + to_string(part));
+}
+
+/*! Complete the current output parts and record the progress of the run,
+ * so an interrupted run can be resumed from here. Called with the output
+ * lock held.
+ */
+void Scorer::write_checkpoint(void)
+{
+   spectrum_writers.clear();
+   output_part++;
+
+   streamoff csv_size = 0;
+   if (list_max)
+   {
+      struct stat csv_stat;
+      csv_fs.flush();
+      if (stat(output_filename(out_file, "", ".csv").c_str(), &csv_stat) == 0)
+         csv_size = csv_stat.st_size;
+   }
+
+   // replace the last checkpoint in one step, so one is always complete
+   string temp_file = checkpoint_file + ".tmp";
+   ofstream checkpoint_fs(temp_file);
+   checkpoint_fs.precision(17);
+   checkpoint_fs << "in_file " << in_file << endl;
+   checkpoint_fs << "first_centre_id " << first_centre_id << endl;
+   checkpoint_fs << "end_centre_id " << end_centre_id << endl;
+   checkpoint_fs << "outputs " << output_files.size() << endl;
+   checkpoint_fs << "next_output_spectrum_id " << next_output_spectrum_id << endl;
+   checkpoint_fs << "output_part " << output_part << endl;
+   checkpoint_fs << "csv_size " << csv_size << endl;
+   for (Size output_idx = 0; output_idx < output_files.size(); ++output_idx)
+   {
+      checkpoint_fs << "output " << output_points[output_idx] << " "
+                    << output_score_sum[output_idx] << " "
+                    << output_score_max[output_idx] << endl;
+   }
+   checkpoint_fs.close();
+   if (!checkpoint_fs or rename(temp_file.c_str(), checkpoint_file.c_str()) != 0)
+   {
+      throw runtime_error(string("could not write checkpoint ") + checkpoint_file);
+   }
+
+   last_checkpoint_id = next_output_spectrum_id;
+   open_writers();
+}
+
+/*! Restore the progress of an interrupted run from its checkpoint.
+ *
+ * Without a checkpoint the run starts from the beginning.
+ *
+ * @param csv_size Set to the size of the '--listmax' CSV output at the
+ * checkpoint.
+ *
+ * @return An error message, empty if the run can resume.
+ */
+string Scorer::read_checkpoint(streamoff &csv_size)
+{
+   ifstream checkpoint_fs(checkpoint_file);
+   if (!checkpoint_fs)
+   {
+      cout << program_name << " no checkpoint " << checkpoint_file << ", starting from the beginning" << endl;
+      return "";
+   }
+
+   string line;
+   Size output_idx = 0;
+   int checkpoint_first = -1;
+   int checkpoint_end = -1;
+   Size checkpoint_outputs = 0;
+   string checkpoint_in_file;
+   while (getline(checkpoint_fs, line))
+   {
+      istringstream line_ss(line);
+      string key;
+      line_ss >> key;
+      if (key == "in_file")
+         checkpoint_in_file = line.substr(line.find(' ') + 1);
+      else if (key == "first_centre_id")
+         line_ss >> checkpoint_first;
+      else if (key == "end_centre_id")
+         line_ss >> checkpoint_end;
+      else if (key == "outputs")
+         line_ss >> checkpoint_outputs;
+      else if (key == "next_output_spectrum_id")
+         line_ss >> next_output_spectrum_id;
+      else if (key == "output_part")
+         line_ss >> output_part;
+      else if (key == "csv_size")
+         line_ss >> csv_size;
+      else if (key == "output" and output_idx < output_points.size())
+      {
+         line_ss >> output_points[output_idx] >> output_score_sum[output_idx] >> output_score_max[output_idx];
+         output_idx++;
+      }
+   }
+
+   if (checkpoint_in_file != in_file or checkpoint_first != first_centre_id
+       or checkpoint_end != end_centre_id or checkpoint_outputs != output_files.size()
+       or output_idx != output_files.size())
+   {
+      return "checkpoint " + checkpoint_file + " is for a different input or options";
+   }
+   return "";
 }
 
 PeakSpectrumPtr Scorer::get_spectrum(int spectrum_id)
 {
    PeakSpectrumPtr spectrum_ptr;
+   uint64_t get_start = profiler.start();
+   PerfSample perf_sample = profiler.perf_start();
 
-   input_spectrum_lock.lock();
+   if (live)
+   {
+      // live spectra are prepared as they are read
+      live_lock.lock();
+      spectrum_ptr = live_spectra.at(spectrum_id);
+      live_lock.unlock();
+      profiler.perf_stop(profile_get_spectrum, perf_sample);
+      profiler.stop(profile_get_spectrum, get_start, spectrum_id);
+      return spectrum_ptr;
+   }
+
+   profiler.lock(input_spectrum_lock, profile_wait_input);
    if (input_spectrum_cache.exists(spectrum_id))
    {
       spectrum_ptr = input_spectrum_cache.get(spectrum_id);
+      profiler.count(profile_cache_hits);
+      progress.cache_lookup(true);
    }
    else
    {
-      spectrum_ptr = make_shared<PeakSpectrum>(input_map.getSpectrum(spectrum_id));
+      uint64_t decode_start = profiler.start();
+      try
+      {
+         spectrum_ptr = make_shared<PeakSpectrum>(input->get_spectrum(selected_spectra[spectrum_id]));
+      }
+      catch (...)
+      {
+         // the other threads carry on until they see the error
+         input_spectrum_lock.unlock();
+         throw;
+      }
+      profiler.stop(profile_decode, decode_start, spectrum_id);
+      uint64_t preprocess_start = profiler.start();
+      preprocess_spectrum(*spectrum_ptr);
+      profiler.stop(profile_preprocess, preprocess_start, spectrum_id);
+      size_t cached = input_spectrum_cache.size();
       input_spectrum_cache.put(spectrum_id, spectrum_ptr);
+      profiler.count(profile_cache_misses);
+      progress.cache_lookup(false);
+      if (input_spectrum_cache.size() == cached)
+         profiler.count(profile_cache_evictions);
    }
    input_spectrum_lock.unlock();
+   profiler.perf_stop(profile_get_spectrum, perf_sample);
+   profiler.stop(profile_get_spectrum, get_start, spectrum_id);
    return spectrum_ptr;
 }
 
-void Scorer::put_spectrum(int spectrum_id, PeakSpectrum spectrum)
+void Scorer::write_spectra(ScoreSpectra &spectra)
 {
-   output_spectrum_lock.lock();
-
-   if (spectrum_id == next_output_spectrum_id)
+   uint64_t write_start = profiler.start();
+   for (Size output_idx = 0; output_idx < spectra.size(); ++output_idx)
    {
-      // this is the next spectrum to output
+      PeakSpectrum &spectrum = spectra[output_idx];
       if (spectrum.size() > 0)
       {
-         spectrum_writer.consumeSpectrum(spectrum);
+         output_points[output_idx] += spectrum.size();
+         for (auto it = spectrum.begin(); it != spectrum.end(); ++it)
+         {
+            output_score_sum[output_idx] += it->getIntensity();
+            output_score_max[output_idx] = max(output_score_max[output_idx], double(it->getIntensity()));
+         }
+         if (score_callback)
+         {
+            score_callback(output_idx, spectrum);
+            continue;
+         }
+         spectrum_writers[output_idx]->consumeSpectrum(spectrum);
          if (list_max)
          {
             for (auto it = spectrum.begin(); it != spectrum.end(); ++it)
@@ -111,90 +649,441 @@ void Scorer::put_spectrum(int spectrum_id, PeakSpectrum spectrum)
             }
          }
       }
-      next_output_spectrum_id++;
+   }
+   profiler.stop(profile_write, write_start);
+}
+
+void Scorer::put_spectrum(int spectrum_id, ScoreSpectra spectra)
+{
+   uint64_t output_start = profiler.start();
+   profiler.lock(output_spectrum_lock, profile_wait_output);
 
-      // try to output more spectra
-      while(output_spectrum_queue.size() > 0)
+   try
+   {
+      if (spectrum_id == next_output_spectrum_id)
       {
-         IndexSpectrum index_spectrum = output_spectrum_queue.top();
-         if (index_spectrum.first == next_output_spectrum_id)
+         // this is the next spectrum to output
+         write_spectra(spectra);
+         next_output_spectrum_id++;
+
+         // try to output more spectra
+         while(output_spectrum_queue.size() > 0)
          {
-            spectrum = index_spectrum.second;  // next in queue
-            if (spectrum.size() > 0)
+            IndexSpectrum index_spectrum = output_spectrum_queue.top();
+            if (index_spectrum.first == next_output_spectrum_id)
             {
-               spectrum_writer.consumeSpectrum(spectrum);
-               if (list_max)
-               {
-                  for (auto it = spectrum.begin(); it != spectrum.end(); ++it)
-                  {
-                     csv_fs << spectrum.getRT() << "," << it->getMZ() << "," << it->getIntensity() << endl; 
-                  }
-               }
+               spectra = index_spectrum.second;  // next in queue
+               write_spectra(spectra);
+               output_spectrum_queue.pop();
+               next_output_spectrum_id++;
+            }
+            else
+            {
+               break;
             }
-            output_spectrum_queue.pop();
-            next_output_spectrum_id++;
-         }
-         else
-         {
-            break;
          }
       }
+      else
+      {
+         // push this spectrum into the queue to write out later
+         output_spectrum_queue.push(IndexSpectrum(spectrum_id, spectra));
+         profiler.count(profile_queued);
+      } 
+      profiler.queue_depth(output_spectrum_queue.size());
+
+      if (live)
+         drop_live_spectra();
+
+      if (checkpoint_interval > 0 and next_output_spectrum_id - last_checkpoint_id >= checkpoint_interval)
+         write_checkpoint();
+   }
+   catch (...)
+   {
+      // a failed write or checkpoint, the other threads carry on until they see the error
+      output_spectrum_lock.unlock();
+      throw;
+   }
+
+   output_spectrum_lock.unlock();
+   profiler.stop(profile_output, output_start, spectrum_id);
+}
+
+/*! Read a live input, a pipe or stream of mzML, to its end.
+ *
+ * The spectra are passed to add_live_spectrum as they are parsed, so scoring
+ * starts while the input is still being written.
+ */
+void Scorer::read_live(void)
+{
+   LiveConsumer consumer(*this);
+   MzMLFile mzml;
+
+   try
+   {
+      // no first pass to count the spectra, the input can only be read once
+      mzml.transform(in_file == "-" ? "/dev/stdin" : in_file, &consumer, true, true);
+   }
+   catch (const exception &e)
+   {
+      // score what was read, up to the error, the error of a failed run is
+      // reported by wait
+      if (!run_failed)
+         cerr << program_name << " ERROR: reading live input " << in_file << ": " << e.what() << endl;
+   }
+
+   end_live_input();
+}
+
+/*! Mark the end of a live input, so the last spectra are scored with the
+ * spectra available.
+ */
+void Scorer::end_live_input(void)
+{
+   live_lock.lock();
+   live_ended = true;
+   live_lock.unlock();
+   live_changed.notify_all();
+}
+
+/*! Add a spectrum read from a live input.
+ *
+ * Waits while live_capacity spectra are held, so a fast input does not use
+ * unbounded memory.
+ *
+ * @param spectrum The spectrum as read.
+ *
+ * @return False once scoring has failed, when the spectrum is dropped and
+ * the rest of the input need not be read. wait throws the error.
+ */
+bool Scorer::add_live_spectrum(PeakSpectrum &spectrum)
+{
+   if (run_failed)
+      return false;
+   if (!select_spectrum(spectrum))
+      return true;
+
+   PeakSpectrumPtr spectrum_ptr = make_shared<PeakSpectrum>(spectrum);
+   uint64_t preprocess_start = profiler.start();
+   if (!spectrum_ptr->isSorted())
+      spectrum_ptr->sortByPosition();
+   preprocess_spectrum(*spectrum_ptr);
+   profiler.stop(profile_preprocess, preprocess_start);
+
+   unique_lock<mutex> lock(live_lock);
+   live_changed.wait(lock, [this]() { return run_failed or live_spectra.size() < live_capacity; });
+   if (run_failed)
+      return false;
+   live_spectra[num_spectra] = spectrum_ptr;
+   num_spectra++;
+   lock.unlock();
+   live_changed.notify_all();
+   return true;
+}
+
+/*! Wait until the window of a live spectrum has been read.
+ *
+ * @param spectrum_id Position of the centre spectrum.
+ *
+ * @return False if the input ended before the centre spectrum, or scoring
+ * has failed.
+ */
+bool Scorer::wait_for_window(int spectrum_id)
+{
+   unique_lock<mutex> lock(live_lock);
+   live_changed.wait(lock, [this, spectrum_id]()
+                     { return run_failed or live_ended or spectrum_id + half_window < int(num_spectra); });
+   return !run_failed and spectrum_id < int(num_spectra);
+}
+
+/*! Drop live spectra no longer in the window of any spectrum still to be
+ * written. Called with the output lock held.
+ */
+void Scorer::drop_live_spectra(void)
+{
+   live_lock.lock();
+   while (!live_spectra.empty() and live_spectra.begin()->first + half_window < next_output_spectrum_id)
+   {
+      live_spectra.erase(live_spectra.begin());
+   }
+   live_lock.unlock();
+   live_changed.notify_all();
+}
+
+/*! Prepare a spectrum as it enters the cache, once per decode.
+ *
+ * Removes points outside the M/Z range, centroids profile spectra and
+ * removes zero and noise intensity points if requested, so the removed
+ * points never enter the windows or get scored as centre points.
+ */
+void Scorer::preprocess_spectrum(PeakSpectrum &spectrum)
+{
+   if (!trim_mz and !centroid and !strip_zeros)
+      return;
+
+   if (!spectrum.isSorted())
+      spectrum.sortByPosition();
+   if (trim_mz)
+      trim_mz_range(spectrum, load_mz_lower, load_mz_upper);
+   if (centroid)
+      centroid_spectrum(spectrum);
+   if (strip_zeros)
+      strip_noise(spectrum, noise_mad, keep_boundary_zeros);
+}
+
+/*! Retention time of a spectrum, from the index metadata when available
+ * so that the spectrum need not be decoded.
+ */
+double Scorer::get_rt(int spectrum_id)
+{
+   if (spectrum_id < spectrum_rts.size())
+      return spectrum_rts[spectrum_id];
+   return get_spectrum(spectrum_id)->getRT();
+}
+
+/*! Test if a spectrum is selected for scoring by MS level, polarity and
+ * scan filter.
+ *
+ * @param meta_spectrum Spectrum metadata (the peaks are not needed).
+ */
+bool Scorer::select_spectrum(const PeakSpectrum &meta_spectrum)
+{
+   if (ms_level > 0 and meta_spectrum.getMSLevel() != UInt(ms_level))
+      return false;
+
+   IonSource::Polarity spectrum_polarity = meta_spectrum.getInstrumentSettings().getPolarity();
+   if (polarity > 0 and spectrum_polarity != IonSource::POSITIVE)
+      return false;
+   if (polarity < 0 and spectrum_polarity != IonSource::NEGATIVE)
+      return false;
+
+   if (scan_filter != "")
+   {
+      if (!meta_spectrum.metaValueExists("filter string"))
+         return false;
+      string filter = meta_spectrum.getMetaValue("filter string").toString();
+      if (filter.find(scan_filter) == string::npos)
+         return false;
+   }
+
+   return true;
+}
+
+/*! M/Z ranges of the targets whose RT range includes a retention time.
+ *
+ * @param rt Retention time in seconds.
+ *
+ * @return The merged, sorted M/Z tolerance ranges of the matching targets.
+ */
+MZRanges Scorer::target_ranges(double rt)
+{
+   MZRanges ranges;
+
+   // targets are sorted by M/Z, so the ranges need only be merged
+   for (auto &target : targets)
+   {
+      if (rt < target.rt_start or rt > target.rt_end)
+         continue;
+
+      double lower_mz = target.mz * (1.0 - target.ppm * 1e-6);
+      double upper_mz = target.mz * (1.0 + target.ppm * 1e-6);
+      if (!ranges.empty() and lower_mz <= ranges.back().second)
+         ranges.back().second = max(ranges.back().second, upper_mz);
+      else
+         ranges.push_back(make_pair(lower_mz, upper_mz));
+   }
+
+   return ranges;
+}
+
+//! @brief Test if an M/Z falls in any of a set of ranges.
+static bool in_ranges(double mz, const MZRanges &ranges)
+{
+   auto after = upper_bound(ranges.begin(), ranges.end(), make_pair(mz, numeric_limits<double>::max()));
+   return after != ranges.begin() and mz <= (after - 1)->second;
+}
+
+int Scorer::get_next_spectrum_todo(void)
+{
+   int this_spectrum;
+   profiler.lock(next_spectrum_lock, profile_wait_next);
+   this_spectrum = current_spectrum_id;
+   current_spectrum_id++;
+   next_spectrum_lock.unlock();
+   return this_spectrum; 
+}
+
+void Scorer::score_worker(int thread_count)
+{
+   int this_spectrum_id;
+   double_vect histogram;
+
+   Profiler::set_thread(thread_count);
+   this_spectrum_id = get_next_spectrum_todo(); 
+
+   if (discover)
+   {
+       histogram.resize(delta_histogram.size());
+   }
+
+   try
+   {
+      while (this_spectrum_id < end_centre_id)
+      {
+          if (live and !wait_for_window(this_spectrum_id))
+          {
+              break;
+          }
+
+          if (debug and (this_spectrum_id % 100) == 0)
+          {
+              cout << "Thread: " << thread_count << " Spectrum: " << this_spectrum_id << endl;
+          }
+
+          if (discover)
+          {
+              // nothing to write, deltas are reported once all threads finish
+              uint64_t discover_start = profiler.start();
+              discover_deltas(this_spectrum_id, histogram);
+              profiler.stop(profile_score, discover_start, this_spectrum_id);
+              profiler.count(profile_spectra);
+              progress.add_spectrum();
+          }
+          else
+          {
+              score_spectrum(this_spectrum_id);
+          }
+
+          this_spectrum_id = get_next_spectrum_todo(); 
+      }
+   }
+   catch (...)
+   {
+      // stop the other threads taking spectra, wait throws the first error
+      run_error_lock.lock();
+      if (!run_error)
+         run_error = current_exception();
+      run_error_lock.unlock();
+      next_spectrum_lock.lock();
+      current_spectrum_id = end_centre_id;
+      next_spectrum_lock.unlock();
+      // wake the live input and the workers waiting on it, taking the lock
+      // so no waiter misses the flag
+      live_lock.lock();
+      run_failed = true;
+      live_lock.unlock();
+      live_changed.notify_all();
+   }
+
+   if (discover)
+   {
+       // merge this thread's histogram into the total
+       delta_histogram_lock.lock();
+       for (Size bin = 0; bin < histogram.size(); ++bin)
+       {
+           delta_histogram[bin] += histogram[bin];
+       }
+       delta_histogram_lock.unlock();
+   }
+}
+
+/*! Score one spectrum and queue the scores to be written in order.
+ *
+ * @param spectrum_id Position of the centre spectrum in the selected spectra.
+ */
+void Scorer::score_spectrum(int spectrum_id)
+{
+   ScoreSpectra scores;
+   uint64_t centre_start = profiler.start();
+   uint64_t score_start = profiler.start();
+   PerfSample perf_sample = profiler.perf_start();
+
+   if (list_max)
+   {
+       scores = ScoreSpectra(1, local_max_spectra(spectrum_id));
+   }
+   else if (!targets.empty() and target_ranges(get_rt(spectrum_id)).empty())
+   {
+       // no targets elute here, so nothing to score or decode
+       scores = ScoreSpectra(output_files.size());
    }
    else
    {
-      // push this spectrum into the queue to write out later
-      output_spectrum_queue.push(pair<int, PeakSpectrum>(spectrum_id, spectrum));
-   } 
+       scores = score_spectra(spectrum_id);
+   }
+   profiler.perf_stop(profile_score, perf_sample);
+   profiler.stop(profile_score, score_start, spectrum_id);
 
-   output_spectrum_lock.unlock();
+   // add RT to spectra
+   double rt = get_rt(spectrum_id);
+   for (auto &score : scores)
+   {
+       score.setRT(rt);
+   }
+   // add to write queue
+   put_spectrum(spectrum_id, scores);
+   profiler.stop(profile_spectrum, centre_start, spectrum_id);
+   profiler.count(profile_spectra);
+   progress.add_spectrum();
 }
 
-int Scorer::get_next_spectrum_todo(void)
+/*! Score the next spectrum no thread has started on, for a shared pool of
+ * threads scoring several files. Not used for discovery.
+ *
+ * @param thread_count Number of the calling thread, for debugging output.
+ *
+ * @return False if every spectrum has already been started.
+ */
+bool Scorer::score_next_spectrum(int thread_count)
+{
+   int this_spectrum_id = get_next_spectrum_todo();
+   if (this_spectrum_id >= end_centre_id)
+      return false;
+
+   if (debug and (this_spectrum_id % 100) == 0)
+   {
+       cout << "Thread: " << thread_count << " File: " << in_file << " Spectrum: " << this_spectrum_id << endl;
+   }
+   score_spectrum(this_spectrum_id);
+   return true;
+}
+
+//! @brief True while some spectrum has not been started by any thread.
+bool Scorer::has_spectra_todo(void)
 {
-   int this_spectrum;
    next_spectrum_lock.lock();
-   this_spectrum = current_spectrum_id;
-   current_spectrum_id++;
+   bool todo = current_spectrum_id < end_centre_id;
    next_spectrum_lock.unlock();
-   return this_spectrum; 
+   return todo;
 }
 
-void Scorer::score_worker(int thread_count)
+//! @brief True once every spectrum has been scored and written.
+bool Scorer::is_complete(void)
 {
-   PeakSpectrum score;
-   int this_spectrum_id;
-
-   this_spectrum_id = get_next_spectrum_todo(); 
-
-   while (this_spectrum_id < num_spectra)
-   {
-       if (debug and (this_spectrum_id % 100) == 0)
-       {
-           cout << "Thread: " << thread_count << " Spectrum: " << this_spectrum_id << endl;
-       }
+   output_spectrum_lock.lock();
+   bool complete = next_output_spectrum_id >= end_centre_id;
+   output_spectrum_lock.unlock();
+   return complete;
+}
 
-       if (list_max)
-       {
-           score = local_max_spectra(this_spectrum_id);
-       }
-       else
-       {
-           score = score_spectra(this_spectrum_id);
-       }
-       
-       // add RT to spectrum
-       PeakSpectrumPtr input_spectrum = get_spectrum(this_spectrum_id);
-       score.setRT(input_spectrum->getRT());
-       // add to write queue
-       put_spectrum(this_spectrum_id, score);
-       
-       this_spectrum_id = get_next_spectrum_todo(); 
-   }
+//! @brief Number of spectra scored and written so far, for progress reports.
+int Scorer::spectra_written(void)
+{
+   output_spectrum_lock.lock();
+   int written = next_output_spectrum_id - first_centre_id;
+   output_spectrum_lock.unlock();
+   return written;
+}
 
+//! @brief Number of spectra to score in all.
+int Scorer::spectra_to_score(void)
+{
+   return end_centre_id - first_centre_id;
 }
 
 void Scorer::collect_local_rows(int rt_offset, double_2d &mz_vals, double_2d &amp_vals)
 {
+    uint64_t window_start = profiler.start();
+    PerfSample perf_sample = profiler.perf_start();
     PeakSpectrumPtr rowi_spectrum;
     // Iterate over the spectra in the window
     for (Size rowi = 0; rowi < mz_vals.size(); ++rowi)
@@ -227,221 +1116,53 @@ void Scorer::collect_local_rows(int rt_offset, double_2d &mz_vals, double_2d &am
             amp_vals[rowi].clear();
         }
     }
-}
-
-void Scorer::collect_window_data(double scale,
-               double_vect & rt_shape,
-               double centre, double sigma,
-               double_2d & mz_vals, double_2d & amp_vals,
-               double lower_bound_mz, double upper_bound_mz,
-               double_vect & data_out, double_vect & shape_out)
-{
-    // Iterate over the spectra in the window
-    for (Size rowi = 0; rowi < mz_vals.size() && rowi < rt_shape.size(); ++rowi)
-    {
-        double rt_shape_i = rt_shape[rowi] * scale;
-        // Select points within tolerance for current spectrum
-        // Want index of bounds
-        // Need to convert iterator to index
-        Size lower_index = Size(std::lower_bound(mz_vals[rowi].begin(),
-                                    mz_vals[rowi].end(),
-                                    lower_bound_mz)
-                                -
-                                mz_vals[rowi].begin());
-        if (lower_index < 0) lower_index = 0;
-        Size upper_index = Size(std::lower_bound(mz_vals[rowi].begin(),
-                                    mz_vals[rowi].end(),
-                                    upper_bound_mz)
-                                -
-                                mz_vals[rowi].begin());
-
-        // Calculate Gaussian value for each found MZ
-        for (Size index = lower_index; index <= upper_index && index < mz_vals[rowi].size(); ++index)
-        {
-            double mz = mz_vals[rowi][index];
-            double intensity = amp_vals[rowi][index];
-
-            // just in case
-            if (mz < lower_bound_mz || mz > upper_bound_mz) continue;
-
-            // calc mz fit
-            mz = (mz - centre) / sigma;
-            mz = -0.5 * mz * mz;
-            double fit = exp(mz) / (sigma * root2pi);
-
-            data_out.push_back(intensity);
-            shape_out.push_back(fit * rt_shape_i);
-        }
-    }
-}
-
-double correlation(double_vect &data, double_vect &shape)
-{
-    // Zero correlation if not enough data in either region
-    if (data.size() < 2 or shape.size() < 2) return 0.0;
-
-    // local copies
-    double_vect X (data);
-    double_vect Y (shape);
-
-    double EX = std::accumulate(X.begin(), X.end(), 0.0) / X.size();
-    double EY = std::accumulate(Y.begin(), Y.end(), 0.0) / Y.size();
-
-    // Centre data in regions relative to combined means
-    for (auto& val : X) val -= EX;
-    for (auto& val : Y) val -= EY;
-
-    // COV and VAR
-    double COV = inner_product(X.begin(), X.end(), Y.begin(), 0.0);
-    double VARX = inner_product(X.begin(), X.end(), X.begin(), 0.0);
-    double VARY = inner_product(Y.begin(), Y.end(), Y.begin(), 0.0);
-
-    double correl = COV / std::sqrt(VARX * VARY);
-    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
-
-    return correl;
-}
-
-double combined_correlation(double_vect &data_nat, double_vect &data_iso,
-                double_vect &shape_nat, double_vect &shape_iso)
-{
-    // local copies
-    double_vect Xa (data_nat);
-    double_vect Xb (data_iso);
-    double_vect Ya (shape_nat);
-    double_vect Yb (shape_iso);
-
-    double EXa = std::accumulate(Xa.begin(), Xa.end(), 0.0) / Xa.size();
-    double EXb = std::accumulate(Xb.begin(), Xb.end(), 0.0) / Xb.size();
-    double EYa = std::accumulate(Ya.begin(), Ya.end(), 0.0) / Ya.size();
-    double EYb = std::accumulate(Yb.begin(), Yb.end(), 0.0) / Yb.size();
-
-    // Combined mean is mean of means
-    double EXab = 0.5 * (EXa + EXb);  // E(Xab) =  E(E(Xa), E(Xb))
-    double EYab = 0.5 * (EYa + EYb);  // E(Yab) =  E(E(Ya), E(Yb))
-
-    // Centre data in regions relative to combined means
-    for (auto& val : Xa) val -= EXab;  // (Xa - E(Xab)) --> C(Xa) 
-    for (auto& val : Xb) val -= EXab;  // (Xb - E(Xab))
-    for (auto& val : Ya) val -= EYab;  // (Ya - E(Yab))
-    for (auto& val : Yb) val -= EYab;  // (Yb - E(Yab))
-
-    // region expected values
-    // E((Xa - E(Xab))(Ya - E(Yab)))
-    // E((Xa - E(Xab))^2)
-    // E((Ya - E(Yab))^2)
-    double ECXaCYa = inner_product(Xa.begin(), Xa.end(), Ya.begin(), 0.0);
-    double ECXa2 = inner_product(Xa.begin(), Xa.end(), Xa.begin(), 0.0);
-    double ECXb2 = inner_product(Xb.begin(), Xb.end(), Xb.begin(), 0.0);
-
-    // E((Xb - E(Xab))(Yb - E(Yab)))
-    // E((Xb - E(Xab))^2)
-    // E((Yb - E(Yab))^2)
-    double ECXbCYb = inner_product(Xb.begin(), Xb.end(), Yb.begin(), 0.0);
-    double ECYa2 = inner_product(Ya.begin(), Ya.end(), Ya.begin(), 0.0);
-    double ECYb2 = inner_product(Yb.begin(), Yb.end(), Yb.begin(), 0.0);
-
-    // Combined COV, VAR as mean region COV and VAR
-    double cov_Xab = 0.5 * (ECXaCYa + ECXbCYb);
-    double var_Xab = 0.5 * (ECXa2 + ECXb2);
-    double var_Yab = 0.5 * (ECYa2 + ECYb2);
-
-    double correl = cov_Xab / std::sqrt(var_Xab * var_Yab);
-    if (std::isnan(correl) or std::isinf(correl)) correl = 0.0;
-
-    return correl;
-}
-
-/*
- * Calculate Meng's Z-score
- * Meng, Rubin, & Rosenthal (1992),
- * Comparing Correlated Correlation Coefficients,
- * Psychological Bulletin 111(1), 172-175.
- */
-double mengZ(double rhoXY, double rhoXZ, double rhoYZ, Size samples, double confidence)
-{
-        // Calculate rm values between correlations
-        double rm2 = 0.5 * (rhoXY * rhoXY + rhoXZ * rhoXZ);
-    
-        // Calculate f values between correlation and rm
-        double f = (1.0 - rhoYZ) / (2.0 * (1.0 - rm2));
-        if (std::isinf(f) or f > 1.0) f = 1.0;
-    
-        // Calculate h values between f and rm
-        double h = (1.0 - f * rm2) / (1.0 - rm2);
-    
-        // Calculate z scores
-        double z = (std::atanh(rhoXY) - std::atanh(rhoXZ)) *
-                std::sqrt( (samples - 3.0) / (2.0 * (1.0 - rhoYZ) * h) );
-        if (std::isnan(z) or std::isinf(z) or z < 0.0) z = 0.0;
-        if (confidence > 0.0) {
-            // Only use score if lower confidence greater than zero
-            double lCI = (std::atanh(rhoXY) - std::atanh(rhoXZ)) - confidence *
-                    std::sqrt((2.0 * (1.0 - rhoYZ) * h) / (samples - 3.0));
-            if (std::isnan(lCI) or std::isinf(lCI) or lCI < 0.0) lCI = 0.0;
-            if (lCI > 0.0) return z;
-        }
-
-        return z;
+    profiler.perf_stop(profile_window, perf_sample);
+    profiler.stop(profile_window, window_start, rt_offset + half_window);
 }
 
 /*! Calculate correlation scores for each MZ point in a central spectrum of
  * a data window.
  *
- * @param map collection of spectra in the input.
+ * The window is collected once, wide enough for every parameter set. For
+ * each parameter set the natural ion region of each centre is collected
+ * once and shared by every ion model.
+ *
  * @param centre_idx Index of the spectrum to score.
- * @param half_window The number of spectra each side of the central spectrum
- * to include.
- * @param opts Options object.
  *
- * @return Vector of score at each MZ in central spectrum.
+ * @return One spectrum per parameter set and ion model with the score at
+ * each MZ in the central spectrum.
  */
 
-PeakSpectrum Scorer::score_spectra(int centre_idx)
+ScoreSpectra Scorer::score_spectra(int centre_idx)
 {
-    // Calculate constant values
-    double local_rt_sigma = rt_width / std_dev_in_fwhm;
-    double mz_ppm_sigma = mz_width / (std_dev_in_fwhm * 1e6);
-    double lower_tol = 1.0 - mz_sigma * mz_ppm_sigma;
-    double upper_tol = 1.0 + mz_sigma * mz_ppm_sigma;
     int rt_offset = centre_idx - half_window;
 
-    // TODO This should be calculated once, then used as look-up
-    // Spacing should also be based on scan intervals
-    // (curently assumed fixed spacing)
-    double_vect rt_shape (local_rows);
+    PeakSpectrumPtr centre_row_points = get_spectrum(centre_idx);
+    ScoreSpectra out_spectra(param_sets.size() * models.size());
+    progress.add_peaks(centre_row_points->size());
 
-    // Calculate Gaussian shape in the RT direction
-    for (Size i = 0; i < local_rows; ++i)
+    // When scoring targets, only centres matching a target at this RT
+    MZRanges ranges;
+    if (!targets.empty())
     {
-        double pt = (i - half_window) / local_rt_sigma;
-        pt = -0.5 * pt * pt;
-        double fit = exp(pt) / (local_rt_sigma * root2pi);
-        rt_shape[i] = fit;
+        ranges = target_ranges(get_rt(centre_idx));
+        auto matches = [&ranges](const Peak1D &p) { return in_ranges(p.getMZ(), ranges); };
+        // Nothing to score, don't collect the window
+        if (none_of(centre_row_points->begin(), centre_row_points->end(), matches))
+        {
+            return out_spectra;
+        }
     }
 
-    PeakSpectrumPtr centre_row_points = get_spectrum(centre_idx);
-
-    // Length of all vectors (= # windows)
-    Size mz_windows = centre_row_points->size();
-
-    double_vect min_score_vect;
-    min_score_vect.reserve(mz_windows);
-
-    // Low (natural ion) peak tolerances
-    double lower_bound_nat = 0.0;
-    double upper_bound_nat = 0.0;
-    // High (isotope ion) peak tolerances
-    double lower_bound_iso = 0.0;
-    double upper_bound_iso = 0.0;
+    // Ion region tolerances
+    double lower_bound = 0.0;
+    double upper_bound = 0.0;
 
     // total data per rt,mz centre
     double nAB = 0.0;
 
     double centre = 0.0;
     double sigma = 0.0;
-    double centre_iso = 0.0;
-    double sigma_iso = 0.0;
 
     // NOTE: much faster to collect all local row data 1st
     double_2d mz_vals (local_rows);
@@ -450,154 +1171,359 @@ PeakSpectrum Scorer::score_spectra(int centre_idx)
     // collect all row data
     collect_local_rows(rt_offset, mz_vals, amp_vals);
 
-    // Calculate tolerances for the lo and hi peak for each central MZ
-    double_vect data_nat;
-    double_vect data_iso;
-    double_vect shape_nat;
-    double_vect shape_iso;
+    // Data and model in each ion region, the natural ion region is first
+    double_2d data_regions (max_members);
+    double_2d shape_regions (max_members);
+    double_vect &data_nat = data_regions[0];
+    double_vect &shape_nat = shape_regions[0];
+
+    // Models passing the first stage screen for the current centre
+    vector<bool> screen_pass(models.size(), true);
+    Size screen_passes = models.size();
 
-    PeakSpectrum out_spectrum;
     Peak1D peak;
     PeakSpectrum::Iterator it;
-    for (it = centre_row_points->begin(); it != centre_row_points->end(); ++it)
+    for (Size set_idx = 0; set_idx < param_sets.size(); ++set_idx)
     {
-        centre = it->getMZ();
-        sigma = centre * mz_ppm_sigma;
-
-        centre_iso = centre + mz_delta;
-        sigma_iso = centre_iso * mz_ppm_sigma;
-
-        lower_bound_nat = centre * lower_tol;
-        upper_bound_nat = centre * upper_tol;
-        lower_bound_iso = centre_iso * lower_tol;
-        upper_bound_iso = centre_iso * upper_tol;
-
-        // reset index back to start
-        data_nat.clear();
-        data_iso.clear();
-        shape_nat.clear();
-        shape_iso.clear();
-
-        collect_window_data(1.0,  rt_shape,
-                        centre, sigma, mz_vals, amp_vals,
-                        lower_bound_nat, upper_bound_nat, data_nat, shape_nat);
-        collect_window_data(intensity_ratio, rt_shape,
-                        centre_iso, sigma_iso, mz_vals, amp_vals,
-                        lower_bound_iso, upper_bound_iso, data_iso, shape_iso);
-
-        // Zero score if not enough data in either region
-        if (data_nat.size() < min_sample or data_iso.size() < min_sample)
+        ScoreParams &params = param_sets[set_idx];
+
+        // Calculate constant values
+        double mz_ppm_sigma = params.mz_width / (std_dev_in_fwhm * 1e6);
+        double lower_tol = 1.0 - mz_sigma * mz_ppm_sigma;
+        double upper_tol = 1.0 + mz_sigma * mz_ppm_sigma;
+        double confidence = params.confidence;
+        // This parameter set's window within the collected rows
+        Size first_row = half_window - params.half_window;
+
+        for (it = centre_row_points->begin(); it != centre_row_points->end(); ++it)
         {
-            continue;
-        }
+            centre = it->getMZ();
 
-        /*
-         * Competing models
-         * Target model with desired isotope ion ratio
-         * Model 1, higher ratio
-         * Model 2, lower ratio
-         */
-
-        /* Formulation
-         * Correlation based on expectations in each region
-         * Low ion region, a
-         * High ion region, b
-         * Correlation is
-         * Covariance = E(E((Xa - E(Xab))(Ya - E(Yab))), E((Xb - E(Xab))(Yb -E(Yab))))
-         * Data Variance = E(E((Xa - E(Xab))^2), E((Xb - E(Xab))^2))
-         * Model Variance = E(E((Ya - E(Yab))^2), E((Yb - E(Yab))^2))
-         */
-
-        // Only contrast if natural ion correlates to model
-        // User lower confidence interval at given confidence
-        if (confidence > 0.0) {
-            double z1 = correlation(data_nat, shape_nat);
-            z1 = std::atanh(z1) - confidence/std::sqrt(data_nat.size() - 3.0);
-            if (std::isnan(z1) or std::isinf(z1) or z1 <= 0.0)
+            if (centre < mz_start or centre > mz_end)
             {
                 continue;
             }
-            // Only contrast if isotope ion correlates to model
-            z1 = correlation(data_iso, shape_iso);
-            z1 = std::atanh(z1) - confidence/std::sqrt(data_nat.size() - 3.0);
-            if (std::isnan(z1) or std::isinf(z1) or z1 <= 0.0)
+
+            if (!targets.empty() and !in_ranges(centre, ranges))
             {
                 continue;
             }
-        }
 
-        /* Alternate models */
-        // Twin ion with different ratios
-        double correl_XabYab = combined_correlation(data_nat, data_iso, shape_nat, shape_iso);
-        double_vect iso_lower (shape_iso);
-        for (auto& val : iso_lower) val *= 0.001;
-        double correl_XabYa_ = combined_correlation(data_nat, data_iso, shape_nat, iso_lower);
-        // inter shape correlation
-        double correl_YabYa_ = combined_correlation(shape_nat, shape_iso, shape_nat, iso_lower);
- 
-        double_vect nat_lower (shape_nat);
-        for (auto& val : nat_lower) val *= 0.001;
-        double correl_XabY_b = combined_correlation(data_nat, data_iso, nat_lower, shape_iso);
-        // inter shape correlation
-        double correl_YabY_b = combined_correlation(shape_nat, shape_iso, nat_lower, shape_iso);
-
-        // Calculate z scores
-        nAB = data_nat.size() + data_iso.size();
-        double zABA0 = mengZ(correl_XabYab, correl_XabYa_, correl_YabYa_, nAB, confidence);
-        double zAB0B = mengZ(correl_XabYab, correl_XabY_b, correl_YabY_b, nAB, confidence);
-    
-        // Find the minimum scores, bounded at zero
-        double min_score = std::max({0.0, std::min({zABA0, zAB0B})});
-    
-        if (min_score > 0)
-        {
-            peak.setMZ(centre);
-            peak.setIntensity(min_score);
-            out_spectrum.push_back(peak);
-        }
-    } 
+            // Cheap first stage, screen each model on the centre row only
+            if (screen_threshold > 0.0)
+            {
+                screen_passes = 0;
+                for (Size model_idx = 0; model_idx < models.size(); ++model_idx)
+                {
+                    screen_pass[model_idx] = screen_centre_row(mz_vals[half_window], amp_vals[half_window],
+                                centre, models[model_idx].offsets, models[model_idx].ratios,
+                                params.intensity_ratio, lower_tol, upper_tol) >= screen_threshold;
+                    screen_passes += screen_pass[model_idx];
+                }
+                screen_passed += screen_passes;
+                screen_rejected += models.size() - screen_passes;
+
+                if (screen_passes == 0 and !screen_report)
+                {
+                    continue;
+                }
+            }
 
-    return out_spectrum;
+            sigma = centre * mz_ppm_sigma;
+
+            // Calculate tolerances for the natural ion peak
+            lower_bound = centre * lower_tol;
+            upper_bound = centre * upper_tol;
+
+            // Zero score for every model if not enough natural ion data,
+            // checked before computing the model
+            if (count_window_data(first_row, params.rt_shape.size(), mz_vals,
+                            lower_bound, upper_bound) < params.min_sample)
+            {
+                continue;
+            }
+
+            // reset index back to start
+            data_nat.clear();
+            shape_nat.clear();
+
+            collect_window_data(1.0, params.rt_shape, first_row,
+                            centre, sigma, mz_vals, amp_vals,
+                            lower_bound, upper_bound, centroid, data_nat, shape_nat);
+
+            // Zero score for every model if not enough natural ion data
+            if (data_nat.size() < params.min_sample)
+            {
+                continue;
+            }
+
+            // Only contrast if natural ion correlates to model
+            // User lower confidence interval at given confidence
+            if (confidence > 0.0) {
+                double z1 = correlation(data_nat, shape_nat);
+                z1 = std::atanh(z1) - confidence/std::sqrt(data_nat.size() - 3.0);
+                if (std::isnan(z1) or std::isinf(z1) or z1 <= 0.0)
+                {
+                    continue;
+                }
+            }
+
+            for (Size model_idx = 0; model_idx < models.size(); ++model_idx)
+            {
+                IonModel &model = models[model_idx];
+                Size regions = model.offsets.size() + 1;
+                bool enough_data = true;
+                bool screened_out = !screen_pass[model_idx];
+
+                if (screened_out and !screen_report)
+                {
+                    continue;
+                }
+
+                nAB = data_nat.size();
+                for (Size member = 1; member < regions && enough_data; ++member)
+                {
+                    double centre_iso = centre + model.offsets[member - 1];
+                    double sigma_iso = centre_iso * mz_ppm_sigma;
+
+                    // Calculate tolerances for the isotope ion peak
+                    lower_bound = centre_iso * lower_tol;
+                    upper_bound = centre_iso * upper_tol;
+
+                    double_vect &data_iso = data_regions[member];
+                    double_vect &shape_iso = shape_regions[member];
+                    data_iso.clear();
+                    shape_iso.clear();
+
+                    // Zero score if not enough data in isotope region
+                    if (count_window_data(first_row, params.rt_shape.size(), mz_vals,
+                                    lower_bound, upper_bound) < params.min_sample)
+                    {
+                        enough_data = false;
+                        break;
+                    }
+
+                    collect_window_data(model.ratios[member - 1] * params.intensity_ratio,
+                                    params.rt_shape, first_row,
+                                    centre_iso, sigma_iso, mz_vals, amp_vals,
+                                    lower_bound, upper_bound, centroid, data_iso, shape_iso);
+
+                    // Zero score if not enough data in isotope region
+                    if (data_iso.size() < params.min_sample)
+                    {
+                        enough_data = false;
+                    }
+                    // Only contrast if isotope ion correlates to model
+                    else if (confidence > 0.0) {
+                        double z1 = correlation(data_iso, shape_iso);
+                        z1 = std::atanh(z1) - confidence/std::sqrt(data_nat.size() - 3.0);
+                        if (std::isnan(z1) or std::isinf(z1) or z1 <= 0.0)
+                        {
+                            enough_data = false;
+                        }
+                    }
+                    nAB += data_iso.size();
+                }
+
+                if (!enough_data)
+                {
+                    continue;
+                }
+
+                /*
+                 * Competing models
+                 * Target model with desired isotope ion ratios
+                 * Alternate models, each with one ion suppressed
+                 * (for twin ions, a higher and a lower ratio)
+                 */
+
+                /* Formulation
+                 * Correlation based on expectations in each region
+                 * Low ion region, a
+                 * High ion regions, b, c, ...
+                 * Correlation is
+                 * Covariance = E(E((Xa - E(Xab))(Ya - E(Yab))), E((Xb - E(Xab))(Yb -E(Yab))), ...)
+                 * Data Variance = E(E((Xa - E(Xab))^2), E((Xb - E(Xab))^2), ...)
+                 * Model Variance = E(E((Ya - E(Yab))^2), E((Yb - E(Yab))^2), ...)
+                 */
+
+                double correl_XY = combined_correlation(data_regions, shape_regions, regions);
+
+                // Find the minimum score over the alternate models, bounded at zero
+                double min_score = std::numeric_limits<double>::max();
+                for (Size member = 0; member < regions; ++member)
+                {
+                    /* Alternate model */
+                    // Multiplet with this member suppressed
+                    double correl_XY_ = combined_correlation(data_regions, shape_regions, regions, member);
+                    // inter shape correlation
+                    double correl_YY_ = combined_correlation(shape_regions, shape_regions, regions, member);
+
+                    // Calculate z score
+                    double z = mengZ(correl_XY, correl_XY_, correl_YY_, nAB, confidence);
+                    min_score = std::min(min_score, z);
+                }
+                min_score = std::max(0.0, min_score);
+
+                if (min_score > 0 and screened_out)
+                {
+                    // only scored to measure the screen's recall
+                    screen_dropped_scores++;
+                }
+                else if (min_score > 0)
+                {
+                    screen_kept_scores++;
+                    peak.setMZ(centre);
+                    peak.setIntensity(min_score);
+                    out_spectra[set_idx * models.size() + model_idx].push_back(peak);
+                }
+            }
+        } 
+    }
+
+    if (verify_fraction > 0.0)
+    {
+        verify_spectrum(centre_idx, *centre_row_points, mz_vals, amp_vals, out_spectra);
+    }
+
+    return out_spectra;
 }
 
+/*! True for a fraction of the centre points, chosen by a hash of their
+ * position, so every run samples the same points whatever the threads do.
+ */
+static bool verify_sample(int spectrum_id, Size point_idx, double fraction)
+{
+    if (fraction >= 1.0)
+        return true;
+    // splitmix64 finaliser
+    uint64_t hash = (uint64_t(spectrum_id) << 32) ^ point_idx;
+    hash += 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash < uint64_t(fraction * 18446744073709551615.0);
+}
 
-bool Scorer::local_max_data(double centre_amp,
-               double_2d & mz_vals, double_2d & amp_vals,
-               double lower_bound_mz, double upper_bound_mz)
+/*! Score a sample of the centre points of a spectrum again with the
+ * reference scoring ('--verify'), and add the deviations of the scores of
+ * the scoring path to the totals.
+ *
+ * The scoring path's score of a point is its intensity in the scored
+ * spectrum of each parameter set and model, zero if it is missing. The
+ * reference score is rounded to the intensity type of the output first,
+ * so only deviations of the scoring itself are counted.
+ *
+ * @param centre_idx Index of the scored spectrum.
+ * @param centre_row_points The scored spectrum.
+ * @param mz_vals M/Z of each point in each row of its window.
+ * @param amp_vals Intensity of each point in each row of its window.
+ * @param out_spectra The scores of the scoring path.
+ */
+void Scorer::verify_spectrum(int centre_idx, const PeakSpectrum &centre_row_points,
+                             const double_2d &mz_vals, const double_2d &amp_vals, const ScoreSpectra &out_spectra)
 {
-    // Iterate over the spectra in the window
-    for (Size rowi = 0; rowi < mz_vals.size(); ++rowi)
+    struct VerifyScore
+    {
+        double mz;
+        double fast;
+        double reference;
+        bool screened; //!< Rejected by the screen
+    };
+
+    double rt = get_rt(centre_idx);
+    MZRanges ranges;
+    if (!targets.empty())
+        ranges = target_ranges(rt);
+
+    vector<VerifyScore> scores;
+    Size centres = 0;
+    for (Size point_idx = 0; point_idx < centre_row_points.size(); ++point_idx)
     {
-        // Select points within tolerance for current spectrum
-        // Want index of bounds
-        // Need to convert iterator to index
-        Size lower_index = Size(std::lower_bound(mz_vals[rowi].begin(),
-                                    mz_vals[rowi].end(),
-                                    lower_bound_mz)
-                                -
-                                mz_vals[rowi].begin());
-        if (lower_index < 0) lower_index = 0;
-        Size upper_index = Size(std::lower_bound(mz_vals[rowi].begin(),
-                                    mz_vals[rowi].end(),
-                                    upper_bound_mz)
-                                -
-                                mz_vals[rowi].begin());
-
-        // fail if larger value found
-        for (Size index = lower_index; index <= upper_index && index < mz_vals[rowi].size(); ++index)
+        double centre = centre_row_points[point_idx].getMZ();
+        if (centre < mz_start or centre > mz_end or (!targets.empty() and !in_ranges(centre, ranges))
+            or !verify_sample(centre_idx, point_idx, verify_fraction))
+        {
+            continue;
+        }
+        centres++;
+
+        for (Size set_idx = 0; set_idx < param_sets.size(); ++set_idx)
         {
-            double mz = mz_vals[rowi][index];
-            double intensity = amp_vals[rowi][index];
+            const ScoreParams &params = param_sets[set_idx];
+            double mz_ppm_sigma = params.mz_width / (std_dev_in_fwhm * 1e6);
+            double lower_tol = 1.0 - mz_sigma * mz_ppm_sigma;
+            double upper_tol = 1.0 + mz_sigma * mz_ppm_sigma;
+            Size first_row = half_window - params.half_window;
+
+            for (Size model_idx = 0; model_idx < models.size(); ++model_idx)
+            {
+                const IonModel &model = models[model_idx];
+                const PeakSpectrum &fast_scores = out_spectra[set_idx * models.size() + model_idx];
+                auto found = lower_bound(fast_scores.begin(), fast_scores.end(), centre,
+                                         [](const Peak1D &peak, double mz) { return peak.getMZ() < mz; });
+
+                VerifyScore score;
+                score.mz = centre;
+                score.fast = found != fast_scores.end() and found->getMZ() == centre ? found->getIntensity() : 0.0;
+                score.reference = Peak1D::IntensityType(reference_score(params.rt_shape, first_row, mz_vals, amp_vals,
+                                centre, model.offsets, model.ratios, params.intensity_ratio, mz_ppm_sigma,
+                                lower_tol, upper_tol, params.min_sample, params.confidence, centroid));
+                score.screened = screen_threshold > 0.0
+                                 and screen_centre_row(mz_vals[half_window], amp_vals[half_window], centre,
+                                        model.offsets, model.ratios, params.intensity_ratio,
+                                        lower_tol, upper_tol) < screen_threshold;
+                scores.push_back(score);
+            }
+        }
+    }
+
+    if (centres == 0)
+        return;
 
-            // just in case
-            if (mz < lower_bound_mz || mz > upper_bound_mz) continue;
+    verify_lock.lock();
+    verify_centres += centres;
+    for (auto &score : scores)
+    {
+        if (score.fast == 0.0 and score.reference == 0.0)
+        {
+            verify_both_zero++;
+            continue;
+        }
 
-            if (intensity > centre_amp)
-                return false;
+        double abs_error = fabs(score.fast - score.reference);
+        verify_abs_errors.add(abs_error);
+        verify_rel_errors.add(abs_error / max(fabs(score.fast), fabs(score.reference)));
+        if (abs_error > verify_max_error)
+        {
+            verify_max_error = abs_error;
+            verify_max_rt = rt;
+            verify_max_mz = score.mz;
+            verify_max_fast = score.fast;
+            verify_max_reference = score.reference;
+        }
 
+        if (score.fast == 0.0 or score.reference == 0.0)
+        {
+            if (score.fast == 0.0)
+            {
+                verify_zero_fast++;
+                verify_zero_screened += score.screened;
+            }
+            else
+            {
+                verify_zero_reference++;
+            }
+            if (verify_examples.size() < verify_show)
+            {
+                ostringstream example;
+                example << setprecision(10) << "RT " << rt << " M/Z " << score.mz << ": scoring path "
+                        << score.fast << ", reference " << score.reference << (score.screened ? " (screened out)" : "");
+                verify_examples.push_back(example.str());
+            }
         }
     }
-    return true;  // nothing greater found
+    verify_lock.unlock();
 }
 
 
@@ -608,6 +1534,7 @@ PeakSpectrum Scorer::local_max_spectra(int centre_idx)
     int rt_offset = centre_idx - half_window;
 
     PeakSpectrumPtr centre_row_points = get_spectrum(centre_idx);
+    progress.add_peaks(centre_row_points->size());
 
     // Length of all vectors (= # windows)
     Size mz_windows = centre_row_points->size();
@@ -627,6 +1554,11 @@ PeakSpectrum Scorer::local_max_spectra(int centre_idx)
         double centre_mz = it->getMZ();
         double centre_amp = it->getIntensity();
 
+        if (centre_mz < mz_start or centre_mz > mz_end)
+        {
+            continue;
+        }
+
         if (local_max_data(centre_amp, mz_vals, amp_vals,
                            centre_mz - mz_width, centre_mz + mz_width))
         {
@@ -638,3 +1570,227 @@ PeakSpectrum Scorer::local_max_spectra(int centre_idx)
 
     return out_spectrum;
 }
+
+
+/*! Report how many centre points the first stage screen passed and, with
+ * '--screen-report', how many nonzero scores it dropped.
+ */
+void Scorer::report_screen(void)
+{
+    Size screened = screen_passed + screen_rejected;
+    cout << "Screen: " << screen_passed << " of " << screened << " points passed";
+    if (screened > 0)
+        cout << " (" << 100.0 * screen_passed / screened << "%)";
+    cout << endl;
+
+    if (screen_report)
+    {
+        Size nonzero = screen_kept_scores + screen_dropped_scores;
+        cout << "Screen: " << screen_dropped_scores << " of " << nonzero << " nonzero scores dropped";
+        if (nonzero > 0)
+            cout << " (recall " << 100.0 * screen_kept_scores / nonzero << "%)";
+        cout << endl;
+    }
+}
+
+/*! Print the deviations of the scoring path from the reference scoring
+ * of the centre points '--verify' sampled.
+ */
+void Scorer::report_verify(void)
+{
+    Size disagreements = verify_zero_fast + verify_zero_reference;
+    cout << "Verify: " << verify_centres << " centre points scored again with the reference (fraction "
+         << verify_fraction << "), " << verify_both_zero << " scores zero in both" << endl;
+    cout << "Verify: " << disagreements << " zero/nonzero disagreements, zero in the scoring path only "
+         << verify_zero_fast << " (" << verify_zero_screened << " screened out), zero in the reference only "
+         << verify_zero_reference << endl;
+    for (auto &example : verify_examples)
+        cout << "Verify:   " << example << endl;
+    verify_abs_errors.report(cout, "Verify: absolute deviation of nonzero scores");
+    verify_rel_errors.report(cout, "Verify: relative deviation of nonzero scores");
+    if (verify_max_error > 0.0)
+    {
+        cout << setprecision(10) << "Verify: largest deviation at RT " << verify_max_rt << " M/Z " << verify_max_mz
+             << ": scoring path " << verify_max_fast << ", reference " << verify_max_reference << endl;
+    }
+    cout << setprecision(6);
+}
+
+/*! Print the '--profile' summary, and write it as JSON if requested.
+ */
+void Scorer::report_profile(void)
+{
+    profiler.report(cout);
+
+    if (profile_json != "")
+    {
+        ofstream profile_fs(profile_json);
+        if (!profile_fs)
+        {
+            cerr << program_name << " ERROR: cannot write profile to " << profile_json << endl;
+            return;
+        }
+        profiler.write_json(profile_fs);
+    }
+}
+
+/*! Write the '--trace' timeline as Chrome trace JSON.
+ */
+void Scorer::write_trace(void)
+{
+    ofstream trace_fs(trace_file);
+    if (!trace_fs)
+    {
+        cerr << program_name << " ERROR: cannot write trace to " << trace_file << endl;
+        return;
+    }
+    profiler.write_trace(trace_fs);
+}
+
+/*! Write the summary table of a parameter sweep.
+ *
+ * One comma separated line for each parameter set and ion model, giving
+ * the parameters, the output file suffix, and the number, sum and maximum
+ * of the scores written to that output.
+ */
+void Scorer::write_sweep_summary(void)
+{
+    ofstream summary_fs(output_filename(out_file, "_sweep", ".csv"));
+    summary_fs.exceptions(ofstream::badbit | ofstream::failbit);
+
+    summary_fs << "set,rt_width,mz_width,iratio,confidence,model,points,score_sum,score_max" << endl;
+    for (Size set_idx = 0; set_idx < param_sets.size(); ++set_idx)
+    {
+        ScoreParams &params = param_sets[set_idx];
+        for (Size model_idx = 0; model_idx < models.size(); ++model_idx)
+        {
+            Size output_idx = set_idx * models.size() + model_idx;
+            summary_fs << set_idx + 1 << "," << params.rt_width << "," << params.mz_width << ","
+                       << params.intensity_ratio << "," << params.confidence << ","
+                       << models[model_idx].label << "," << output_points[output_idx] << ","
+                       << output_score_sum[output_idx] << "," << output_score_max[output_idx] << endl;
+        }
+    }
+}
+
+/*! Add the M/Z differences between peaks in the RT window of one spectrum
+ * to a histogram of candidate deltas.
+ *
+ * Only the most intense peaks of each row of the window are paired. Each
+ * peak of the centre spectrum is paired with every higher M/Z peak of every
+ * row, so ions which co-elute but peak a scan or two apart still pair, and
+ * each pair is counted once, at the spectrum of its lower ion. A pair adds
+ * the geometric mean of its intensities, weighted by the RT Gaussian of the
+ * distance between its rows, to the bin of its M/Z difference, so
+ * differences between ions which co-occur strongly and repeatedly over the
+ * retention time build up the most support.
+ *
+ * @param spectrum_id Index of the spectrum.
+ * @param histogram Support for each M/Z delta bin, updated in place.
+ */
+void Scorer::discover_deltas(int spectrum_id, double_vect &histogram)
+{
+    int rt_offset = spectrum_id - half_window;
+    double local_rt_sigma = rt_width / std_dev_in_fwhm;
+
+    double_2d mz_vals (local_rows);
+    double_2d amp_vals (local_rows);
+    collect_local_rows(rt_offset, mz_vals, amp_vals);
+    progress.add_peaks(mz_vals[half_window].size());
+
+    // the most intense peaks of each row as (M/Z, intensity), by M/Z
+    vector<vector<pair<double, double>>> row_peaks(local_rows);
+    auto more_intense = [](const pair<double, double> &a, const pair<double, double> &b) { return a.second > b.second; };
+    for (Size rowi = 0; rowi < local_rows; ++rowi)
+    {
+        auto &peaks = row_peaks[rowi];
+        for (Size index = 0; index < mz_vals[rowi].size(); ++index)
+            peaks.push_back(make_pair(mz_vals[rowi][index], amp_vals[rowi][index]));
+        if (peaks.size() > discover_peaks)
+        {
+            nth_element(peaks.begin(), peaks.begin() + discover_peaks, peaks.end(), more_intense);
+            peaks.resize(discover_peaks);
+        }
+        sort(peaks.begin(), peaks.end());
+    }
+
+    const auto &centre_peaks = row_peaks[half_window];
+    for (Size rowi = 0; rowi < local_rows; ++rowi)
+    {
+        double pt = (double(rowi) - half_window) / local_rt_sigma;
+        double rt_weight = exp(-0.5 * pt * pt);
+        const auto &peaks = row_peaks[rowi];
+
+        for (const auto &lo : centre_peaks)
+        {
+            for (const auto &hi : peaks)
+            {
+                double delta = hi.first - lo.first;
+                if (delta < discover_min_delta) continue;
+                if (delta >= discover_max_delta) break;
+
+                Size bin = Size((delta - discover_min_delta) / discover_bin_width);
+                if (bin < histogram.size())
+                {
+                    histogram[bin] += rt_weight * std::sqrt(lo.second * hi.second);
+                }
+            }
+        }
+    }
+}
+
+/*! Report the best supported candidate deltas from the discovery histogram.
+ *
+ * Candidates are the local maxima of the histogram, located to within a bin
+ * by the support weighted mean of the peak bin and its neighbours. They are
+ * listed in order of support on standard output and, if an output file was
+ * given, as comma separated delta, support and fraction of total support.
+ */
+void Scorer::report_deltas(void)
+{
+    double total = std::accumulate(delta_histogram.begin(), delta_histogram.end(), 0.0);
+    vector<pair<double, Size>> candidates;
+
+    for (Size bin = 0; bin < delta_histogram.size(); ++bin)
+    {
+        double support = delta_histogram[bin];
+        double before = bin > 0 ? delta_histogram[bin - 1] : 0.0;
+        double after = bin + 1 < delta_histogram.size() ? delta_histogram[bin + 1] : 0.0;
+        if (support > 0.0 && support > before && support >= after)
+        {
+            candidates.push_back(make_pair(support, bin));
+        }
+    }
+    sort(candidates.rbegin(), candidates.rend());
+    if (candidates.size() > discover_top)
+        candidates.resize(discover_top);
+
+    ofstream report_fs;
+    if (out_file != "")
+    {
+        report_fs.open(out_file);
+        report_fs.exceptions(ofstream::badbit | ofstream::failbit);
+    }
+
+    cout << "delta,support,fraction" << endl;
+    if (report_fs.is_open())
+        report_fs << "delta,support,fraction" << endl;
+
+    for (auto &candidate : candidates)
+    {
+        Size bin = candidate.second;
+        double weight = 0.0;
+        double delta = 0.0;
+        for (Size near = (bin > 0 ? bin - 1 : bin); near <= bin + 1 && near < delta_histogram.size(); ++near)
+        {
+            double near_delta = discover_min_delta + (near + 0.5) * discover_bin_width;
+            weight += delta_histogram[near];
+            delta += delta_histogram[near] * near_delta;
+        }
+        delta /= weight;
+
+        cout << delta << "," << candidate.first << "," << candidate.first / total << endl;
+        if (report_fs.is_open())
+            report_fs << delta << "," << candidate.first << "," << candidate.first / total << endl;
+    }
+}
@@ -3,75 +3,205 @@
 
 #include <OpenMS/KERNEL/OnDiscMSExperiment.h>
 #include <OpenMS/FORMAT/DATAACCESS/MSDataWritingConsumer.h>
+#include <exception>
 #include <queue>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 #include "options.h"
 #include "vector.h"
 #include "lru_cache.h"
+#include "input.h"
+#include "compare.h"
+#include "profile.h"
+#include "progress.h"
 
 using namespace OpenMS;
 using namespace std;
 
+// Scored versions of one input spectrum, one per output file
+typedef vector<PeakSpectrum> ScoreSpectra;
+typedef pair<int, ScoreSpectra> IndexSpectrum;
+
 struct IndexSpectrumOrder 
 {
-   bool operator()(pair<int, PeakSpectrum> const& a, pair<int, PeakSpectrum> const& b) const
+   bool operator()(IndexSpectrum const& a, IndexSpectrum const& b) const
    {
        return a.first > b.first;
    }
 };
 
-typedef shared_ptr<PeakSpectrum> PeakSpectrumPtr;
-typedef cache::lru_cache<Int, PeakSpectrumPtr> SpectrumLRUCache;
-typedef pair<int, PeakSpectrum> IndexSpectrum;
+// Sorted, non-overlapping M/Z ranges
+typedef vector<pair<double, double>> MZRanges;
+
+typedef shared_ptr<PlainMSDataWritingConsumer> SpectrumWriterPtr;
+
+/*! Receives each scored spectrum instead of an output file, in spectrum
+ * order. Spectra with no scored points are skipped, as in the output files;
+ * the RT of each spectrum gives its place in the input. The
+ * outputs are numbered by parameter set, then by model, as param_sets and
+ * models in the Options. Called with an output lock held, so it must not
+ * call back into the Scorer. An exception it throws stops scoring and is
+ * thrown again by run or wait.
+ */
+typedef function<void(Size output_idx, PeakSpectrum &spectrum)> ScoreCallback;
 typedef priority_queue<IndexSpectrum, vector<IndexSpectrum>, IndexSpectrumOrder> SpectrumQueue;
 
 class Scorer 
 {
 private:
    // attributes
-   unsigned int num_spectra;
+   atomic<unsigned int> num_spectra; //!< Grows as spectra are read in live mode
    int current_spectrum_id;
    int next_output_spectrum_id;
+   int first_centre_id; //!< First spectrum to score
+   int end_centre_id; //!< One past the last spectrum to score
    int half_window;
    OpenMS::Size local_rows;
    bool debug;
    double list_max;
-   double intensity_ratio;
+   bool discover;
+   double discover_min_delta;
+   double discover_max_delta;
+   double discover_bin_width;
+   Size discover_peaks;
+   Size discover_top;
+   double_vect delta_histogram; //!< Support for each M/Z delta bin, summed over all threads
    double rt_width;
    double rt_sigma;
    double ppm;
    double mz_width;
    double mz_sigma;
-   double mz_delta;
-   double min_sample;
-   double confidence;
+   vector<IonModel> models; //!< Ion models to score
+   Size max_members; //!< Largest number of ions in any model
+   vector<ScoreParams> param_sets; //!< Parameter sets to score, each with every model
+   string sweep_file;
+   vector<Target> targets; //!< Targets to score sorted by M/Z, all points if empty
+   double_vect spectrum_rts; //!< RT of each selected spectrum from the index metadata
+   int spectrum_start;
+   int spectrum_end;
+   double rt_start;
+   double rt_end;
+   double mz_start;
+   double mz_end;
+   bool trim_mz; //!< Remove points outside load_mz_lower to load_mz_upper as spectra are read
+   double load_mz_lower;
+   double load_mz_upper;
+   int ms_level;
+   int polarity;
+   string scan_filter;
+   vector<Size> selected_spectra; //!< File index of each selected spectrum, in file order
+   bool centroid;
+   bool strip_zeros;
+   double noise_mad;
+   bool keep_boundary_zeros;
+   double screen_threshold;
+   bool screen_report;
+   double verify_fraction; //!< Fraction of centre points scored again with the reference, zero for none
+   mutex verify_lock;
+   Size verify_centres; //!< Centre points scored again
+   Size verify_both_zero; //!< Scores zero in both the scoring path and the reference
+   Size verify_zero_fast; //!< Scores zero in the scoring path only
+   Size verify_zero_screened; //!< Of those, scores the screen rejected
+   Size verify_zero_reference; //!< Scores zero in the reference only
+   ErrorDistribution verify_abs_errors; //!< Deviation of scores nonzero in either
+   ErrorDistribution verify_rel_errors;
+   double verify_max_error; //!< Largest deviation, and where it was
+   double verify_max_rt;
+   double verify_max_mz;
+   double verify_max_fast;
+   double verify_max_reference;
+   vector<string> verify_examples; //!< First zero/nonzero disagreements
+   atomic<Size> screen_passed; //!< Centre points (per set and model) passing the screen
+   atomic<Size> screen_rejected; //!< Centre points (per set and model) rejected by the screen
+   atomic<Size> screen_kept_scores; //!< Nonzero scores of points passing the screen
+   atomic<Size> screen_dropped_scores; //!< Nonzero scores of points rejected by the screen
+   vector<Size> output_points; //!< Number of scored points written to each output
+   double_vect output_score_sum; //!< Sum of scores written to each output
+   double_vect output_score_max; //!< Largest score written to each output
    unsigned int num_threads;
    string in_file;
    string out_file;
-   OnDiscPeakMap input_map;
-   PlainMSDataWritingConsumer spectrum_writer;
+   SpectrumSourcePtr input;
+   ScoreCallback score_callback; //!< Receives the scores instead of the output files, if set
+   vector<thread> threads;
+   thread reader; //!< Reads a live input file
+   vector<string> output_files; //!< Output file of each spectrum writer
+   vector<SpectrumWriterPtr> spectrum_writers;
+   int checkpoint_interval; //!< Spectra written between checkpoints, zero for none
+   bool resume;
+   string checkpoint_file;
+   int output_part; //!< Output part being written, when checkpointing
+   int last_checkpoint_id; //!< next_output_spectrum_id at the last checkpoint
    SpectrumLRUCache input_spectrum_cache;
+   bool live; //!< Score spectra as they are read from a stream
+   map<int, PeakSpectrumPtr> live_spectra; //!< Live spectra read and still needed, by position
+   Size live_capacity; //!< Most live spectra held at once
+   bool live_ended; //!< Set once the whole live input has been read
+   mutex live_lock;
+   condition_variable live_changed; //!< Signalled when live spectra are added or dropped
    SpectrumQueue output_spectrum_queue;
    std::ofstream csv_fs;
+   // Each Scorer has its own locks, so a batch can score several files at once
+   mutex output_spectrum_lock;
+   mutex next_spectrum_lock;
+   exception_ptr run_error; //!< First error of a scoring thread, thrown again by wait
+   mutex run_error_lock;
+   atomic<bool> run_failed; //!< Set with run_error, stops the workers and the live input
+   mutex input_spectrum_lock;
+   mutex delta_histogram_lock;
+   Profiler profiler; //!< Stage timers and counters, if '--profile' or '--trace'
+   bool profile; //!< Report the profile at the end
+   string profile_json; //!< File to write the profile to as JSON
+   string trace_file; //!< File to write the timeline of each thread to
+   Progress progress; //!< Reports progress while scoring, if '--progress' or '--status-file'
    
    // methods
    int get_next_spectrum_todo(void);
-   void put_spectrum(int spectrum_id, PeakSpectrum spectrum);
+   void put_spectrum(int spectrum_id, ScoreSpectra spectra);
+   void write_spectra(ScoreSpectra &spectra);
    PeakSpectrumPtr get_spectrum(int spectrum_id);
-   PeakSpectrum score_spectra(int centre_idx);
+   void preprocess_spectrum(PeakSpectrum &spectrum);
+   double get_rt(int spectrum_id);
+   bool select_spectrum(const PeakSpectrum &meta_spectrum);
+   MZRanges target_ranges(double rt);
+   ScoreSpectra score_spectra(int centre_idx);
    PeakSpectrum local_max_spectra(int centre_idx);
    void collect_local_rows(int, double_2d&, double_2d&);
-   void collect_window_data(double,
-                  double_vect&, double, double, double_2d&, double_2d&,
-                  double, double, double_vect&, double_vect&);
-   bool local_max_data(double,
-                  double_2d&, double_2d&,
-                  double, double);
+   void score_spectrum(int spectrum_id);
+   void open_writers(void);
+   string part_filename(Size output_idx, int part);
+   void write_checkpoint(void);
+   string read_checkpoint(streamoff &csv_size);
+   void read_live(void);
+   bool wait_for_window(int spectrum_id);
+   void drop_live_spectra(void);
+   void discover_deltas(int spectrum_id, double_vect &histogram);
+   void report_deltas(void);
+   void write_sweep_summary(void);
+   void verify_spectrum(int centre_idx, const PeakSpectrum &centre_row_points,
+                        const double_2d &mz_vals, const double_2d &amp_vals, const ScoreSpectra &out_spectra);
+   void report_screen(void);
+   void report_verify(void);
+   void report_profile(void);
+   void write_trace(void);
 
 public:
-   Scorer(bool debug, bool list_max, double intensity_ratio, double rt_width, 
-         double mz_width, double mz_delta, double confidence,
-         int num_threads, int input_spectrum_cache_size,
-         string in_file, string out_file);
-  void score_worker(int thread_count);
+   Scorer(const Options &opts, SpectrumSourcePtr input = nullptr, ScoreCallback score_callback = nullptr);
+   void run(void);
+   void start(void);
+   void wait(void);
+   void finish(void);
+   void score_worker(int thread_count);
+   bool score_next_spectrum(int thread_count);
+   bool add_live_spectrum(PeakSpectrum &spectrum);
+   void end_live_input(void);
+   bool has_spectra_todo(void);
+   bool is_complete(void);
+   int spectra_written(void);
+   int spectra_to_score(void);
 };
 #endif
@@ -0,0 +1,292 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include "constants.h"
+#include "score.h"
+#include "server.h"
+
+using namespace std;
+
+// Exit statuses of the child checking a job's options
+static const int job_options_valid = 3;
+static const int job_options_exit = 4;
+static const int job_options_invalid = 5;
+// Longest job request accepted, in bytes
+static const size_t max_request_length = 65536;
+
+Server::Server(const Options &opts)
+   : socket_path(opts.serve_socket)
+   , cache_size(opts.serve_cache_size)
+   , input_files(opts.serve_files)
+{
+}
+
+/*! Accept and run jobs until the server is killed.
+ */
+void Server::run(void)
+{
+   // a client hanging up must not kill the server
+   signal(SIGPIPE, SIG_IGN);
+
+   int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (server_fd < 0)
+   {
+      throw runtime_error(string("could not create socket: ") + strerror(errno));
+   }
+
+   struct sockaddr_un address;
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   if (socket_path.size() >= sizeof(address.sun_path))
+   {
+      throw runtime_error(string("socket path is too long: ") + socket_path);
+   }
+   strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+   unlink(socket_path.c_str());
+
+   if (bind(server_fd, (struct sockaddr *) &address, sizeof(address)) < 0
+       or listen(server_fd, SOMAXCONN) < 0)
+   {
+      throw runtime_error(string("could not listen on ") + socket_path + ": " + strerror(errno));
+   }
+   cout << program_name << " serving on " << socket_path << endl;
+
+   while (true)
+   {
+      int client_fd = accept(server_fd, NULL, NULL);
+      if (client_fd < 0)
+         continue;
+
+      // read one request line
+      string request;
+      char c;
+      while (request.size() < max_request_length and read(client_fd, &c, 1) == 1 and c != '\n')
+         request += c;
+
+      run_job(client_fd, request);
+      close(client_fd);
+   }
+}
+
+/*! Find a loaded input file, or load it.
+ *
+ * Files modified since they were loaded are loaded again.
+ */
+InputFilePtr Server::get_input(const string &in_file)
+{
+   if (input_files.exists(in_file))
+   {
+      InputFilePtr input = input_files.get(in_file);
+      if (input->is_current())
+         return input;
+   }
+   InputFilePtr input = make_shared<InputFile>(in_file, cache_size);
+   input_files.put(in_file, input);
+   return input;
+}
+
+/*! Check the options of a job without risk to the server.
+ *
+ * The options are first parsed in a child process, with its output and any
+ * error sent to the client. The child only flushes and calls _exit(), as
+ * it is a copy of a server that may have other threads. A job that asks
+ * only for '--help' or '--version' gets that text, but is not run.
+ *
+ * @return Empty if the options are valid, otherwise why the job is refused.
+ */
+string Server::check_job(int client_fd, vector<char *> &job_argv)
+{
+   cout.flush();
+   cerr.flush();
+   pid_t pid = fork();
+   if (pid < 0)
+      return string("could not check the job: ") + strerror(errno);
+   if (pid == 0)
+   {
+      dup2(client_fd, STDOUT_FILENO);
+      dup2(client_fd, STDERR_FILENO);
+      int child_status = job_options_valid;
+      try
+      {
+         Options job_opts(job_argv.size() - 1, job_argv.data());
+         if (job_opts.batch_file != "" or job_opts.serve_socket != "")
+            throw runtime_error("a server job cannot use '--batch' or '--serve'");
+         // a live input may be a pipe, which opening here would disturb
+         if (!job_opts.live and !ifstream(job_opts.in_file))
+            throw runtime_error(string("cannot open input file ") + job_opts.in_file);
+      }
+      catch (const OptionsExit &e)
+      {
+         cout << e.what() << endl;
+         child_status = e.status == 0 ? job_options_exit : job_options_invalid;
+      }
+      catch (const OptionsError &e)
+      {
+         cout << e.what() << endl;
+         child_status = job_options_invalid;
+      }
+      catch (const exception &e)
+      {
+         cerr << program_name << " ERROR: " << e.what() << endl;
+         child_status = job_options_invalid;
+      }
+      catch (...)
+      {
+         child_status = job_options_invalid;
+      }
+      cout.flush();
+      cerr.flush();
+      _exit(child_status);
+   }
+   int status;
+   while (waitpid(pid, &status, 0) < 0)
+   {
+      if (errno != EINTR)
+         return string("could not check the job: ") + strerror(errno);
+   }
+   if (WIFEXITED(status) and WEXITSTATUS(status) == job_options_valid)
+      return "";
+   if (WIFEXITED(status) and WEXITSTATUS(status) == job_options_exit)
+      return "job asks only for help or the version, nothing to score";
+   return "invalid job";
+}
+
+/*! Send a line to a client, however many writes it takes.
+ *
+ * @return False if the client has hung up or the write failed.
+ */
+static bool send_line(int client_fd, const string &line)
+{
+   string text = line + "\n";
+   size_t sent = 0;
+   while (sent < text.size())
+   {
+      ssize_t written = write(client_fd, text.data() + sent, text.size() - sent);
+      if (written < 0 and errno == EINTR)
+         continue;
+      if (written <= 0)
+         return false;
+      sent += written;
+   }
+   return true;
+}
+
+/*! Run one job, sending its output and progress to the client.
+ *
+ * A job that fails, e.g. on an input that cannot be loaded, ends with an
+ * "ERROR" line to the client, and the server carries on with the next job.
+ *
+ * @param client_fd Connection to the client.
+ * @param request The hitime-score arguments of the job, separated by white space.
+ */
+void Server::run_job(int client_fd, const string &request)
+{
+   vector<string> args = {"hitime-score"};
+   istringstream request_ss(request);
+   string arg;
+   while (request_ss >> arg)
+      args.push_back(arg);
+
+   vector<char *> job_argv;
+   for (auto &job_arg : args)
+      job_argv.push_back(&job_arg[0]);
+   job_argv.push_back(NULL);
+
+   string refused = check_job(client_fd, job_argv);
+   if (refused != "")
+   {
+      if (!send_line(client_fd, "ERROR " + refused))
+         cerr << program_name << " WARNING: could not reply to a client: " << strerror(errno) << endl;
+      return;
+   }
+
+   // the job's output, including the scorer's reports, goes to the client
+   cout.flush();
+   cerr.flush();
+   int saved_stdout = dup(STDOUT_FILENO);
+   int saved_stderr = dup(STDERR_FILENO);
+   if (saved_stdout < 0 or saved_stderr < 0
+       or dup2(client_fd, STDOUT_FILENO) < 0 or dup2(client_fd, STDERR_FILENO) < 0)
+   {
+      string error = string("could not send output to the client: ") + strerror(errno);
+      if (saved_stdout >= 0)
+      {
+         dup2(saved_stdout, STDOUT_FILENO);
+         close(saved_stdout);
+      }
+      if (saved_stderr >= 0)
+      {
+         dup2(saved_stderr, STDERR_FILENO);
+         close(saved_stderr);
+      }
+      cerr << program_name << " ERROR: job failed: " << error << endl;
+      if (!send_line(client_fd, "ERROR " + error))
+         cerr << program_name << " WARNING: could not reply to a client: " << strerror(errno) << endl;
+      return;
+   }
+
+   string error;
+   try
+   {
+      Options job_opts(job_argv.size() - 1, job_argv.data());
+      // a live job reads its input as it is written, so it is not loaded or kept
+      Scorer scorer(job_opts, job_opts.live ? nullptr : get_input(job_opts.in_file));
+
+      atomic<bool> finished{false};
+      exception_ptr job_error;
+      thread runner([&]() {
+         try
+         {
+            scorer.run();
+         }
+         catch (...)
+         {
+            job_error = current_exception();
+         }
+         finished = true;
+      });
+      for (int tick = 1; !finished; ++tick)
+      {
+         this_thread::sleep_for(chrono::milliseconds(100));
+         if (tick % 10 == 0)
+            cout << "PROGRESS " << scorer.spectra_written() << "/" << scorer.spectra_to_score() << endl;
+      }
+      runner.join();
+      if (job_error)
+         rethrow_exception(job_error);
+      cout << "DONE " << job_opts.out_file << endl;
+   }
+   catch (const exception &e)
+   {
+      error = e.what();
+   }
+
+   cout.flush();
+   cerr.flush();
+   dup2(saved_stdout, STDOUT_FILENO);
+   dup2(saved_stderr, STDERR_FILENO);
+   close(saved_stdout);
+   close(saved_stderr);
+   // writes fail once a client hangs up, carry on with the next job
+   cout.clear();
+   cerr.clear();
+
+   if (error != "")
+   {
+      cerr << program_name << " ERROR: job failed: " << error << endl;
+      if (!send_line(client_fd, "ERROR " + error))
+         cerr << program_name << " WARNING: could not reply to a client: " << strerror(errno) << endl;
+   }
+}
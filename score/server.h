@@ -0,0 +1,39 @@
+#ifndef HITIME_SERVER_H
+#define HITIME_SERVER_H
+
+#include <string>
+#include <vector>
+#include "options.h"
+#include "input.h"
+#include "lru_cache.h"
+
+using namespace std;
+
+typedef cache::lru_cache<string, InputFilePtr> InputFileCache;
+
+/*! A long running server taking scoring jobs on a Unix domain socket.
+ *
+ * Each connection sends one job as a line of hitime-score arguments, e.g.
+ * "-i run.mzML -o run.score.mzML -d 6.0201 -r 17 -m 150". Jobs run one at a
+ * time. The server keeps the most recently used input files loaded, each
+ * with a cache of decoded spectra, so later jobs on the same file skip the
+ * index load and most of the decoding. Output and progress of the job are
+ * sent back over the connection, ending with a "DONE" or "ERROR" line.
+ */
+class Server
+{
+private:
+   string socket_path;
+   size_t cache_size; //!< Number of decoded spectra kept for each input file
+   InputFileCache input_files; //!< Loaded input files, by path
+
+   // methods
+   InputFilePtr get_input(const string &in_file);
+   void run_job(int client_fd, const string &request);
+   string check_job(int client_fd, vector<char *> &job_argv);
+
+public:
+   Server(const Options &opts);
+   void run(void);
+};
+#endif
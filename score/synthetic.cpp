@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include "constants.h"
+#include "synthetic.h"
+
+using namespace std;
+
+SyntheticParams::SyntheticParams()
+    : scans(1000)
+    , points(1400)
+    , profile(false)
+    , ms2_per_ms1(0)
+    , pairs(100)
+    , mz_delta(default_mz_delta)
+    , ratio(default_intensity_ratio)
+    , mz_lower(100.0)
+    , mz_upper(1000.0)
+    , rt_width(default_rt_width)
+    , mz_width(default_fwhm)
+    , scan_time(1.0)
+    , height(1e6)
+    , noise(1e3)
+    , seed(1)
+{
+}
+
+/*! Place the pairs of a run at random M/Z and retention times.
+ */
+SyntheticRun::SyntheticRun(const SyntheticParams &params)
+    : params(params)
+{
+    ms1_scans = (params.scans + params.ms2_per_ms1) / (params.ms2_per_ms1 + 1);
+    double rt_sigma = params.rt_width / std_dev_in_fwhm;
+    half_elution = int(ceil(3.0 * rt_sigma));
+    pairs_near.resize(ms1_scans);
+    if (ms1_scans == 0)
+        return;
+
+    mt19937 rng(params.seed);
+    uniform_real_distribution<double> mz_dist(params.mz_lower, params.mz_upper - params.mz_delta);
+    uniform_int_distribution<size_t> apex_dist(0, ms1_scans - 1);
+    uniform_real_distribution<double> height_dist(0.1 * params.height, params.height);
+
+    for (size_t pair_idx = 0; pair_idx < params.pairs; ++pair_idx)
+    {
+        SyntheticPair pair;
+        pair.mz = mz_dist(rng);
+        pair.apex = apex_dist(rng);
+        pair.rt = pair.apex * (params.ms2_per_ms1 + 1) * params.scan_time;
+        pair.height = height_dist(rng);
+        pairs.push_back(pair);
+
+        size_t first = pair.apex < size_t(half_elution) ? 0 : pair.apex - half_elution;
+        for (size_t ms1_id = first; ms1_id <= pair.apex + half_elution and ms1_id < ms1_scans; ++ms1_id)
+            pairs_near[ms1_id].push_back(pair_idx);
+    }
+}
+
+/*! Add the points of one ion peak to a spectrum: a single centroid, or
+ * profile points sampling a Gaussian of the M/Z width over two standard
+ * deviations either side.
+ */
+void SyntheticRun::add_ion(SyntheticScan &scan, double mz, double intensity) const
+{
+    if (!params.profile)
+    {
+        scan.mz.push_back(mz);
+        scan.amp.push_back(intensity);
+        return;
+    }
+
+    double mz_sigma = mz * params.mz_width / (std_dev_in_fwhm * 1e6);
+    for (int step = -4; step <= 4; ++step)
+    {
+        double offset = step * 0.5;
+        scan.mz.push_back(mz + offset * mz_sigma);
+        scan.amp.push_back(intensity * exp(-0.5 * offset * offset));
+    }
+}
+
+/*! Generate one spectrum of the run.
+ *
+ * MS1 spectra have noise points plus the eluting pairs, MS2 spectra have
+ * noise fragments below a random precursor M/Z.
+ */
+SyntheticScan SyntheticRun::get_scan(size_t scan_id) const
+{
+    SyntheticScan scan;
+    scan.rt = scan_id * params.scan_time;
+    scan.precursor_mz = 0.0;
+
+    seed_seq seeds = {params.seed, unsigned(scan_id), unsigned(uint64_t(scan_id) >> 32)};
+    mt19937 rng(seeds);
+    lognormal_distribution<double> noise_dist(log(params.noise), 1.0);
+    size_t cycle = params.ms2_per_ms1 + 1;
+
+    if (scan_id % cycle == 0)
+    {
+        scan.ms_level = 1;
+        uniform_real_distribution<double> mz_dist(params.mz_lower, params.mz_upper);
+        for (size_t point = 0; point < params.points; ++point)
+        {
+            scan.mz.push_back(mz_dist(rng));
+            scan.amp.push_back(noise_dist(rng));
+        }
+
+        size_t ms1_id = scan_id / cycle;
+        double rt_sigma = params.rt_width / std_dev_in_fwhm;
+        for (size_t pair_idx : pairs_near[ms1_id])
+        {
+            const SyntheticPair &pair = pairs[pair_idx];
+            double offset = (double(ms1_id) - double(pair.apex)) / rt_sigma;
+            double intensity = pair.height * exp(-0.5 * offset * offset);
+            add_ion(scan, pair.mz, intensity);
+            add_ion(scan, pair.mz + params.mz_delta, intensity * params.ratio);
+        }
+    }
+    else
+    {
+        scan.ms_level = 2;
+        uniform_real_distribution<double> precursor_dist(params.mz_lower, params.mz_upper);
+        scan.precursor_mz = precursor_dist(rng);
+        uniform_real_distribution<double> mz_dist(params.mz_lower, scan.precursor_mz);
+        for (size_t point = 0; point < params.points / 10; ++point)
+        {
+            scan.mz.push_back(mz_dist(rng));
+            scan.amp.push_back(noise_dist(rng));
+        }
+    }
+
+    // sort the points by M/Z
+    vector<size_t> order(scan.mz.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return scan.mz[a] < scan.mz[b]; });
+    double_vect mz(order.size());
+    double_vect amp(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        mz[i] = scan.mz[order[i]];
+        amp[i] = scan.amp[order[i]];
+    }
+    scan.mz.swap(mz);
+    scan.amp.swap(amp);
+    return scan;
+}
@@ -0,0 +1,83 @@
+#ifndef HITIME_SYNTHETIC_H
+#define HITIME_SYNTHETIC_H
+
+/*
+ * Synthetic LC-MS runs with twin ion pairs at known M/Z, retention time,
+ * M/Z delta and intensity ratio, for benchmarking and for checking that
+ * scoring recovers the pairs. Part of hitime_core, so it does not depend
+ * on OpenMS; hitime-generate writes the runs as mzML.
+ */
+
+#include <cstddef>
+#include <vector>
+#include "vector.h"
+
+//! Shape of a synthetic run.
+struct SyntheticParams
+{
+    size_t scans; //!< Number of spectra, MS1 and MS2
+    size_t points; //!< Number of noise points in each MS1 spectrum
+    bool profile; //!< Sample ion peaks as profile points rather than centroids
+    size_t ms2_per_ms1; //!< Number of MS2 spectra after each MS1 spectrum
+    size_t pairs; //!< Number of twin ion pairs
+    double mz_delta; //!< M/Z difference of the heavier ion
+    double ratio; //!< Intensity of the heavier ion relative to the natural ion
+    double mz_lower; //!< M/Z range of the spectra
+    double mz_upper;
+    double rt_width; //!< Retention time FWHM of the ions, in MS1 spectra
+    double mz_width; //!< M/Z FWHM of the ions, in PPM
+    double scan_time; //!< Retention time between spectra, in seconds
+    double height; //!< Largest apex intensity of a natural ion
+    double noise; //!< Median intensity of the noise points
+    unsigned seed; //!< Random seed, the same seed gives the same run
+
+    SyntheticParams();
+};
+
+//! An injected twin ion pair.
+struct SyntheticPair
+{
+    double mz; //!< M/Z of the natural ion
+    size_t apex; //!< MS1 spectrum of the elution apex
+    double rt; //!< Retention time of the apex
+    double height; //!< Apex intensity of the natural ion
+};
+
+//! One spectrum of a synthetic run, with its points in M/Z order.
+struct SyntheticScan
+{
+    double rt;
+    unsigned ms_level;
+    double precursor_mz; //!< M/Z selected for an MS2 spectrum
+    double_vect mz;
+    double_vect amp;
+};
+
+/*! A synthetic run, generated one spectrum at a time.
+ *
+ * The pairs are placed when the run is constructed. Each spectrum is
+ * generated from its own random seed, so a spectrum is the same whether
+ * it is generated alone or in order, and a run of any size can be
+ * written without holding it in memory.
+ */
+class SyntheticRun
+{
+private:
+    SyntheticParams params;
+    std::vector<SyntheticPair> pairs;
+    //! Index of the pairs by apex MS1 spectrum, for generating each spectrum
+    std::vector<std::vector<size_t>> pairs_near;
+    size_t ms1_scans;
+    int half_elution; //!< Number of MS1 spectra an ion elutes over either side of its apex
+
+    void add_ion(SyntheticScan &scan, double mz, double intensity) const;
+
+public:
+    SyntheticRun(const SyntheticParams &params);
+    size_t size(void) const { return params.scans; }
+    size_t ms1_size(void) const { return ms1_scans; }
+    const std::vector<SyntheticPair> &get_pairs(void) const { return pairs; }
+    SyntheticScan get_scan(size_t scan_id) const;
+};
+
+#endif
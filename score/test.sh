@@ -1 +1,15 @@
-./hitime-score -i ../data/testing.mzML -o ../data/score.mzML
+#!/bin/bash
+
+set -e
+
+./hitime-score -i ../data/testing.mzML -o ../data/score.mzML -r 17 -m 150 -d 6.0201
+
+# A run split into parts and merged must match the single run, with the
+# same spectrum IDs and indices.
+./hitime-score -i ../data/testing.mzML -o ../data/score_part1.mzML --spectrum-range 0:20 -r 17 -m 150 -d 6.0201
+./hitime-score -i ../data/testing.mzML -o ../data/score_part2.mzML --spectrum-range 20:48 -r 17 -m 150 -d 6.0201
+./hitime-merge -o ../data/score_merged.mzML ../data/score_part1.mzML ../data/score_part2.mzML
+./hitime-compare ../data/score.mzML ../data/score_merged.mzML
+diff <(grep -o '<spectrum index="[0-9]*" id="[^"]*"' ../data/score.mzML) \
+     <(grep -o '<spectrum index="[0-9]*" id="[^"]*"' ../data/score_merged.mzML)
+rm -f ../data/score_part1.mzML ../data/score_part2.mzML ../data/score_merged.mzML
@@ -2,6 +2,7 @@
 #define HITIME_VECTOR_H
 
 #include <vector>
+#include <stdexcept>
 
 //! Type definition for a standard vector of doubles
 typedef std::vector<double> double_vect;
@@ -0,0 +1,120 @@
+#!/bin/bash
+
+# End-to-end throughput benchmark of hitime-score on a synthetic run.
+#
+# Generates a run with hitime-generate, scores it at each combination of
+# thread count (-j) and input spectrum cache size (-c), and reports the
+# wall time, spectra scored per second, peak resident memory and speedup
+# over the first thread count. Then it finds the local maxima of the
+# scores and checks that the injected twin ion pairs are recovered.
+#
+# Usage:
+#
+#   scripts/benchmark_e2e.sh [-b build_dir] [-w work_dir] [-j "1 2 4 8"]
+#       [-c "50 200"] [-r rt_width] [-m mz_width] [-d mz_delta] [-a ratio]
+#       [-t rt_tolerance] [-p ppm_tolerance] [-f min_fraction]
+#       [-- hitime-generate options]
+#
+# e.g. a larger profile run with MS2 spectra interleaved:
+#
+#   scripts/benchmark_e2e.sh -b score -j "1 4 16" -- --scans 20000 --points 5000 --profile --ms2 3
+#
+# The table is also written to benchmark_e2e.csv in the work directory.
+# Exits with status 1 if fewer than min_fraction of the pairs are recovered.
+# Needs GNU time (/usr/bin/time) for the peak memory.
+
+BUILD_DIR=.
+WORK_DIR=benchmark_e2e
+THREADS="1 2 4 8"
+CACHES="50"
+RT_WIDTH=17
+MZ_WIDTH=150
+MZ_DELTA=6.0201
+RATIO=1
+RT_TOLERANCE=10
+PPM_TOLERANCE=150
+MIN_FRACTION=0.9
+
+while getopts "b:w:j:c:r:m:d:a:t:p:f:h" opt; do
+    case $opt in
+        b) BUILD_DIR=$OPTARG ;;
+        w) WORK_DIR=$OPTARG ;;
+        j) THREADS=$OPTARG ;;
+        c) CACHES=$OPTARG ;;
+        r) RT_WIDTH=$OPTARG ;;
+        m) MZ_WIDTH=$OPTARG ;;
+        d) MZ_DELTA=$OPTARG ;;
+        a) RATIO=$OPTARG ;;
+        t) RT_TOLERANCE=$OPTARG ;;
+        p) PPM_TOLERANCE=$OPTARG ;;
+        f) MIN_FRACTION=$OPTARG ;;
+        *) sed -n '3,24p' "$0"; exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+GENERATE="$BUILD_DIR/hitime-generate"
+SCORE="$BUILD_DIR/hitime-score"
+for program in "$GENERATE" "$SCORE" /usr/bin/time; do
+    if [ ! -x "$program" ]; then
+        echo "benchmark_e2e.sh: $program not found" >&2
+        exit 2
+    fi
+done
+
+mkdir -p "$WORK_DIR" || exit 2
+RUN="$WORK_DIR/synthetic.mzML"
+PAIRS="$WORK_DIR/synthetic_pairs.csv"
+RESULTS="$WORK_DIR/benchmark_e2e.csv"
+
+echo "generating $RUN"
+"$GENERATE" -o "$RUN" -d "$MZ_DELTA" -a "$RATIO" -r "$RT_WIDTH" -m "$MZ_WIDTH" "$@" > "$WORK_DIR/generate.txt" || exit 2
+MS1_SPECTRA=$(awk '$1 == "ms1_spectra" { print $2 }' "$WORK_DIR/generate.txt")
+tr '\n' ' ' < "$WORK_DIR/generate.txt"; echo
+
+# score only the MS1 spectra, in case MS2 spectra are interleaved
+SCORE_ARGS="-r $RT_WIDTH -m $MZ_WIDTH -d $MZ_DELTA -a $RATIO --ms-level 1"
+
+echo "threads,cache,seconds,spectra_per_second,peak_rss_mb,speedup" > "$RESULTS"
+printf "%8s %8s %10s %12s %12s %8s\n" threads cache seconds spectra/s peak_MB speedup
+for cache in $CACHES; do
+    base_seconds=""
+    for threads in $THREADS; do
+        /usr/bin/time -f "%e %M" -o "$WORK_DIR/time.txt" \
+            "$SCORE" -i "$RUN" -o "$WORK_DIR/score.mzML" -j "$threads" -c "$cache" $SCORE_ARGS \
+            > "$WORK_DIR/score.log" 2>&1 || { echo "hitime-score failed, see $WORK_DIR/score.log" >&2; exit 2; }
+        read seconds rss_kb < <(tail -n 1 "$WORK_DIR/time.txt")
+        if [ -z "$base_seconds" ]; then
+            base_seconds=$seconds
+        fi
+        row=$(awk -v t="$threads" -v c="$cache" -v s="$seconds" -v kb="$rss_kb" -v n="$MS1_SPECTRA" -v b="$base_seconds" \
+            'BEGIN { printf "%d,%d,%.2f,%.1f,%.1f,%.2f", t, c, s, s > 0 ? n / s : 0, kb / 1024, s > 0 ? b / s : 0 }')
+        echo "$row" >> "$RESULTS"
+        echo "$row" | awk -F, '{ printf "%8d %8d %10.2f %12.1f %12.1f %8.2f\n", $1, $2, $3, $4, $5, $6 }'
+    done
+done
+
+# recovery of the injected pairs, from the local maxima of the last scores
+"$SCORE" -i "$WORK_DIR/score.mzML" -o "$WORK_DIR/max.mzML" -r "$RT_WIDTH" -m 0.25 --listmax \
+    > "$WORK_DIR/max.log" 2>&1 || { echo "hitime-score --listmax failed, see $WORK_DIR/max.log" >&2; exit 2; }
+
+awk -F, -v rt_tol="$RT_TOLERANCE" -v ppm_tol="$PPM_TOLERANCE" -v min_fraction="$MIN_FRACTION" '
+    # local maxima: rt, mz, score
+    FILENAME == ARGV[1] { if ($3 > 0) { max_rt[n] = $1; max_mz[n] = $2; n++ } next }
+    # pairs: mz, heavy_mz, rt, ms1_spectrum, height
+    FNR == 1 { next }
+    {
+        pairs++
+        for (i = 0; i < n; i++) {
+            dmz = max_mz[i] - $1
+            drt = max_rt[i] - $3
+            if (dmz < 0) dmz = -dmz
+            if (drt < 0) drt = -drt
+            if (drt <= rt_tol && dmz * 1e6 / $1 <= ppm_tol) { recovered++; break }
+        }
+    }
+    END {
+        fraction = pairs > 0 ? recovered / pairs : 0
+        printf "recovered %d of %d pairs (%.1f%%)\n", recovered, pairs, 100 * fraction
+        exit fraction < min_fraction ? 1 : 0
+    }' "$WORK_DIR/max.csv" "$PAIRS"